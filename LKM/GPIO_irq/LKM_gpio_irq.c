@@ -1,94 +1,401 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/fs.h>
-#include <linux/cdev.h>
+#include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/wait.h>
 
-/* P9_27 */
-#define GPIO_BUTTON 115
-/* P9_23 */
-#define GPIO_LED 49
+#include "gpio_irq_events.h"
 
 /* Meta information */
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("DLH");
 MODULE_DESCRIPTION("Control and LED with a button using interrupts");
 
+/*
+ * GPIO numbers are parameters so that the module also runs without the
+ * board, on lines of the gpio-sim or gpio-mockup drivers.
+ */
+/* P9_27 */
+static int button_gpio = 115;
+module_param(button_gpio, int, 0444);
+MODULE_PARM_DESC(button_gpio, "GPIO of the button");
+
+/* P9_23 */
+static int led_gpio = 49;
+module_param(led_gpio, int, 0444);
+MODULE_PARM_DESC(led_gpio, "GPIO of the LED toggled on every edge, -1 for none");
+
+static int debounce_ms = 100;
+module_param(debounce_ms, int, 0444);
+MODULE_PARM_DESC(debounce_ms, "Button debounce time in ms, 0 to capture every edge");
+
+static char *edge = "rising";
+module_param(edge, charp, 0444);
+MODULE_PARM_DESC(edge, "Edges captured: rising, falling or both");
+
+static bool threaded;
+module_param(threaded, bool, 0444);
+MODULE_PARM_DESC(threaded, "Toggle the LED and wake up readers from an IRQ thread");
+
+static unsigned int ring_size = 4096;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Edges kept until read, rounded up to a power of 2");
+
+static unsigned long overflows;
+module_param(overflows, ulong, 0444);
+MODULE_PARM_DESC(overflows, "Edges dropped because the ring was full");
+
 unsigned int irq_number;
 static bool ledStatus = 0;
+static unsigned long irq_trigger;
+
+/*
+ * Single producer, single consumer ring. Only one of the IRQ handler or
+ * the IRQ thread writes head, depending on the mode (neither runs on two
+ * CPUs at once), and only readers, serialized by read_lock, write tail.
+ * When it is full, new edges are dropped and counted in overflows.
+ */
+static struct gpio_irq_event *ring;
+static unsigned int ring_mask;
+static unsigned int ring_head;
+static unsigned int ring_tail;
+static u32 edge_seq;
+static DEFINE_MUTEX(read_lock);
+static DECLARE_WAIT_QUEUE_HEAD(read_queue);
+
+/*
+ * How edges reach the ring depends on the button controller:
+ * - the usual case, a hard IRQ: the handler queues the edge;
+ * - a nested IRQ (I2C expanders...), run in the thread of the parent IRQ
+ *   without any hard handler: the handler queues it, it may sleep;
+ * - a hard IRQ of a controller that can sleep (gpio-sim...) with both
+ *   edges: the level can't be read from the handler, which only takes the
+ *   timestamp. The IRQ thread reads the level and queues the edge.
+ */
+static bool irq_nested;
+static bool edge_deferred;
+/* The edge the IRQ thread has to queue in deferred mode */
+static DEFINE_SPINLOCK(deferred_lock);
+static bool deferred_pending;
+static u64 deferred_ns;
+static u32 deferred_seq;
+
+static u32 irq_edge(bool can_sleep) {
+	int level;
 
-static irq_handler_t gpio_irq_handler(unsigned int irq, void *dev_id, struct pt_regs *regs) {
-	printk("Triggered interrupt\n");
+	if (irq_trigger == IRQF_TRIGGER_RISING)
+		return GPIO_EDGE_RISING;
+	if (irq_trigger == IRQF_TRIGGER_FALLING)
+		return GPIO_EDGE_FALLING;
+	/* Both edges: the level tells, unless the line changed again meanwhile */
+	if (can_sleep)
+		level = gpio_get_value_cansleep(button_gpio);
+	else
+		level = gpio_get_value(button_gpio);
+	return level ? GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+}
+
+static void toggle_led(bool can_sleep) {
+	if (led_gpio < 0)
+		return;
 	ledStatus = !ledStatus;
-	gpio_set_value(GPIO_LED, ledStatus);
-	return (irq_handler_t) IRQ_HANDLED;
+	if (can_sleep)
+		gpio_set_value_cansleep(led_gpio, ledStatus);
+	else
+		gpio_set_value(led_gpio, ledStatus);
+}
+
+/* Producer side of the ring */
+static void queue_edge(u64 timestamp_ns, u32 seq, u32 edge) {
+	unsigned int head = ring_head;
+	struct gpio_irq_event *ev;
+
+	if (head - smp_load_acquire(&ring_tail) > ring_mask) {
+		WRITE_ONCE(overflows, overflows + 1);
+		return;
+	}
+
+	ev = &ring[head & ring_mask];
+	ev->timestamp_ns = timestamp_ns;
+	ev->seq = seq;
+	ev->edge = edge;
+	/* The event is complete before readers can see it */
+	smp_store_release(&ring_head, head + 1);
+}
+
+/* Top half: timestamp the edge and queue it, nothing else */
+static irqreturn_t gpio_irq_handler(int irq, void *dev_id) {
+	u64 now = ktime_get_ns();
+
+	if (edge_deferred) {
+		/* An edge the thread has not queued yet is replaced, seq shows it */
+		spin_lock(&deferred_lock);
+		deferred_pending = true;
+		deferred_ns = now;
+		deferred_seq = edge_seq++;
+		spin_unlock(&deferred_lock);
+		return IRQ_WAKE_THREAD;
+	}
+
+	queue_edge(now, edge_seq++, irq_edge(irq_nested));
+
+	if (threaded && !irq_nested)
+		return IRQ_WAKE_THREAD;
+
+	toggle_led(irq_nested);
+	wake_up_interruptible(&read_queue);
+	return IRQ_HANDLED;
 }
 
+/* Bottom half in threaded or deferred mode. In threaded mode, edges arriving meanwhile are still queued by the top half */
+static irqreturn_t gpio_irq_thread(int irq, void *dev_id) {
+	bool pending;
+	u64 timestamp_ns;
+	u32 seq;
+
+	if (edge_deferred) {
+		/* The thread may run once more for an edge it already queued */
+		spin_lock_irq(&deferred_lock);
+		pending = deferred_pending;
+		deferred_pending = false;
+		timestamp_ns = deferred_ns;
+		seq = deferred_seq;
+		spin_unlock_irq(&deferred_lock);
+		if (pending)
+			queue_edge(timestamp_ns, seq, irq_edge(true));
+	}
+
+	toggle_led(true);
+	wake_up_interruptible(&read_queue);
+	return IRQ_HANDLED;
+}
+
+static bool ring_empty(void) {
+	return READ_ONCE(ring_tail) == smp_load_acquire(&ring_head);
+}
+
+/* Read callback: whole struct gpio_irq_event only, blocks until there is one */
+static ssize_t driver_read(struct file *File, char __user *user_buffer, size_t count, loff_t *offs) {
+	unsigned int head, tail;
+	ssize_t done = 0;
+
+	if (count < sizeof(struct gpio_irq_event))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&read_lock))
+		return -ERESTARTSYS;
+
+	while (ring_empty()) {
+		mutex_unlock(&read_lock);
+		if (File->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(read_queue, !ring_empty()))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&read_lock))
+			return -ERESTARTSYS;
+	}
+
+	head = smp_load_acquire(&ring_head);
+	for (tail = ring_tail; tail != head && done + sizeof(*ring) <= count; tail++) {
+		if (copy_to_user(user_buffer + done, &ring[tail & ring_mask], sizeof(*ring))) {
+			if (!done)
+				done = -EFAULT;
+			break;
+		}
+		done += sizeof(*ring);
+	}
+
+	/* Gives the slots back to the IRQ handler once copied */
+	smp_store_release(&ring_tail, tail);
+	mutex_unlock(&read_lock);
+
+	return done;
+}
+
+static __poll_t driver_poll(struct file *File, poll_table *wait) {
+	poll_wait(File, &read_queue, wait);
+
+	return ring_empty() ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.read = driver_read,
+	.poll = driver_poll,
+};
+
+/* /dev/gpio_irq_events */
+static struct miscdevice gpio_irq_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "gpio_irq_events",
+	.fops = &fops,
+	.mode = 0444,
+};
+
 static int __init ModuleInit(void) {
+	int ret = -EBUSY;
+
 	/* printk writes to dmesg */
 	printk("Hi, I'm a new LKM for GPIOs!\n");
 
-	/* LED on GPIO 49 (pin 23 on header P9) */
-	if(gpio_request(GPIO_LED, "bbb-gpio-49")) {
-		printk("Can not allocate GPIO %d\n", GPIO_LED);
+	if (!strcmp(edge, "rising"))
+		irq_trigger = IRQF_TRIGGER_RISING;
+	else if (!strcmp(edge, "falling"))
+		irq_trigger = IRQF_TRIGGER_FALLING;
+	else if (!strcmp(edge, "both"))
+		irq_trigger = IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING;
+	else {
+		printk("Invalid edge %s\n", edge);
+		return -EINVAL;
 	}
-	/* Set GPIO direction */
-	/* Second argument is the value at initiatlisation, 0 or 1. */
-	if(gpio_direction_output(GPIO_LED, 0)) {
-		printk("Can not set GPIO %d to output\n", GPIO_LED);
-		goto GPIOLEDError;
+
+	ring_size = roundup_pow_of_two(clamp(ring_size, 2U, 1U << 20));
+	ring_mask = ring_size - 1;
+	ring = kcalloc(ring_size, sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	/* LED on GPIO 49 (pin 23 on header P9) */
+	if (led_gpio >= 0) {
+		if(gpio_request(led_gpio, "bbb-gpio-led")) {
+			printk("Can not allocate GPIO %d\n", led_gpio);
+			goto GPIORequestError;
+		}
+		/* Set GPIO direction */
+		/* Second argument is the value at initiatlisation, 0 or 1. */
+		if(gpio_direction_output(led_gpio, 0)) {
+			printk("Can not set GPIO %d to output\n", led_gpio);
+			goto GPIOLEDError;
+		}
+		/* An LED behind a sleeping bus (I2C expander...) can't be set from the hard IRQ */
+		if (!threaded && gpio_cansleep(led_gpio)) {
+			printk("GPIO %d can sleep, using a threaded IRQ\n", led_gpio);
+			threaded = true;
+		}
 	}
 
-	/* Button on GPIO 117 (pin xx on header P9) */
-	if(gpio_request(GPIO_BUTTON, "bbb-gpio-115")) {
-		printk("Can not allocate GPIO %d\n", GPIO_BUTTON);
+	/* Button on GPIO 115 (pin 27 on header P9) */
+	if(gpio_request(button_gpio, "bbb-gpio-button")) {
+		printk("Can not allocate GPIO %d\n", button_gpio);
 		goto GPIOLEDError;
 	}
 	/* Set GPIO direction */
-	if(gpio_direction_input(GPIO_BUTTON)) {
-		printk("Can not set GPIO %d to output\n", GPIO_BUTTON);
+	if(gpio_direction_input(button_gpio)) {
+		printk("Can not set GPIO %d to input\n", button_gpio);
 		goto GPIOButtonError;
 	}
 	/* Debounce the button */
-	/* Second argument is the duration for which to ignore the bounces. */
-	gpio_set_debounce(GPIO_BUTTON, 100);
+	/* Second argument is the duration for which to ignore the bounces, in us. */
+	if (debounce_ms > 0) {
+		ret = gpio_set_debounce(button_gpio, debounce_ms * 1000);
+		if (ret == -ENOTSUPP) {
+			printk("GPIO %d can't be debounced, capturing every edge\n", button_gpio);
+		} else if (ret) {
+			printk("Can not debounce GPIO %d\n", button_gpio);
+			goto GPIOButtonError;
+		}
+	}
 	/* Export GPIO so that it appearts in SYSFS */
-	gpio_export(GPIO_LED, false);
-	gpio_export(GPIO_BUTTON, false);
+	if (led_gpio >= 0)
+		gpio_export(led_gpio, false);
+	gpio_export(button_gpio, false);
+
+	ret = misc_register(&gpio_irq_device);
+	if (ret) {
+		printk("Can't register /dev/%s\n", gpio_irq_device.name);
+		goto GPIOButtonError;
+	}
+
+	ret = gpio_to_irq(button_gpio);
+	if (ret < 0) {
+		printk("GPIO %d has no IRQ\n", button_gpio);
+		goto MiscError;
+	}
+	irq_number = ret;
 
-	irq_number = gpio_to_irq(GPIO_BUTTON);
+	/* Left disabled until the handlers know how the IRQ is delivered */
+	irq_set_status_flags(irq_number, IRQ_NOAUTOEN);
 
 	/* Triggers are defined in linux/interrupt.h */
 	/* https://elixir.bootlin.com/linux/v4.19.94/source/include/linux/interrupt.h */
-	if(request_irq(irq_number, (irq_handler_t) gpio_irq_handler, IRQF_TRIGGER_RISING, "custom_gpio_irq", NULL) != 0) {
+	/* Tells whether the IRQ is nested in the thread of its parent */
+	ret = request_any_context_irq(irq_number, gpio_irq_handler, irq_trigger,
+				      "custom_gpio_irq", NULL);
+	if (ret < 0) {
 		printk("Failed to request IRQ %d\n", irq_number);
-		goto GPIOButtonError;
+		goto IRQFlagsError;
+	}
+	irq_nested = ret == IRQC_IS_NESTED;
+
+	/* A hard IRQ that needs a thread: the LED or the level can sleep, or asked for */
+	edge_deferred = !irq_nested && gpio_cansleep(button_gpio) &&
+			irq_trigger == (IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING);
+	if (!irq_nested && (threaded || edge_deferred)) {
+		free_irq(irq_number, NULL);
+		ret = request_threaded_irq(irq_number, gpio_irq_handler, gpio_irq_thread,
+					   irq_trigger, "custom_gpio_irq", NULL);
+		if (ret) {
+			printk("Failed to request IRQ %d\n", irq_number);
+			goto IRQFlagsError;
+		}
 	}
+	if (irq_nested)
+		printk("IRQ %d is nested, edges are timestamped in thread context\n", irq_number);
+	else if (edge_deferred)
+		printk("GPIO %d can sleep, edges are read from the IRQ thread\n", button_gpio);
 
+	irq_clear_status_flags(irq_number, IRQ_NOAUTOEN);
+	enable_irq(irq_number);
 
 	return 0;
 
+IRQFlagsError:
+	irq_clear_status_flags(irq_number, IRQ_NOAUTOEN);
+
+MiscError:
+	misc_deregister(&gpio_irq_device);
+
 GPIOButtonError:
-	gpio_free(GPIO_BUTTON);
+	gpio_unexport(button_gpio);
+	gpio_free(button_gpio);
 
 GPIOLEDError:
-	gpio_free(GPIO_LED);
-	return -1;
+	if (led_gpio >= 0) {
+		gpio_unexport(led_gpio);
+		gpio_free(led_gpio);
+	}
+
+GPIORequestError:
+	kfree(ring);
+	return ret;
 }
 
 static void __exit ModuleExit(void) {
 	free_irq(irq_number, NULL);
-	gpio_set_value(GPIO_LED, 0); /* Set the GPIO value to 0 before freeing it. */
-	gpio_unexport(GPIO_LED);
-	gpio_unexport(GPIO_BUTTON);
-	gpio_free(GPIO_LED);
-	gpio_free(GPIO_BUTTON);
+	misc_deregister(&gpio_irq_device);
+	if (led_gpio >= 0) {
+		gpio_set_value_cansleep(led_gpio, 0); /* Set the GPIO value to 0 before freeing it. */
+		gpio_unexport(led_gpio);
+		gpio_free(led_gpio);
+	}
+	gpio_unexport(button_gpio);
+	gpio_free(button_gpio);
+	kfree(ring);
 	printk("Goodbye, Kernel :'(\n");
 }
 
 /* Define entry point */
 module_init(ModuleInit);
 /* Define exit point */
-module_exit(ModuleExit);
\ No newline at end of file
+module_exit(ModuleExit);
@@ -0,0 +1,19 @@
+/*
+ * Events read from /dev/gpio_irq_events, shared between LKM_gpio_irq and
+ * userspace. read() returns whole events only.
+ */
+#ifndef GPIO_IRQ_EVENTS_H
+#define GPIO_IRQ_EVENTS_H
+
+#include <linux/types.h>
+
+#define GPIO_EDGE_RISING  0
+#define GPIO_EDGE_FALLING 1
+
+struct gpio_irq_event {
+	__u64 timestamp_ns;	/* CLOCK_MONOTONIC, taken in the IRQ handler */
+	__u32 seq;		/* edges seen before this one, dropped ones included */
+	__u32 edge;		/* GPIO_EDGE_* */
+};
+
+#endif /* GPIO_IRQ_EVENTS_H */
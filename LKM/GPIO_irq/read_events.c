@@ -0,0 +1,64 @@
+/*
+ * Prints the edges captured by LKM_gpio_irq, with the time since the
+ * previous one.
+ *
+ *   gcc -o read_events read_events.c
+ *   sudo ./read_events
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "gpio_irq_events.h"
+
+#define DEV "/dev/gpio_irq_events"
+
+static const char *edge_names[] = {
+	[GPIO_EDGE_RISING] = "rising",
+	[GPIO_EDGE_FALLING] = "falling",
+};
+
+int main(void)
+{
+	struct gpio_irq_event ev[64];
+	struct pollfd pfd;
+	uint32_t expected = 0;
+	uint64_t last = 0;
+	int first = 1;
+
+	pfd.fd = open(DEV, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd < 0) {
+		perror("open");
+		return EXIT_FAILURE;
+	}
+	pfd.events = POLLIN;
+
+	while (poll(&pfd, 1, -1) > 0) {
+		ssize_t len = read(pfd.fd, ev, sizeof(ev));
+
+		if (len < 0)
+			continue;
+
+		for (size_t i = 0; i < len / sizeof(ev[0]); i++) {
+			/* A gap in seq: the ring was full and edges were dropped */
+			if (!first && ev[i].seq != expected)
+				printf("[!] %u edges lost\n", ev[i].seq - expected);
+
+			printf("%u %llu.%09llu %-7s +%llu ns\n", ev[i].seq,
+			       (unsigned long long)ev[i].timestamp_ns / 1000000000,
+			       (unsigned long long)ev[i].timestamp_ns % 1000000000,
+			       ev[i].edge <= GPIO_EDGE_FALLING ? edge_names[ev[i].edge] : "?",
+			       first ? 0ULL : (unsigned long long)(ev[i].timestamp_ns - last));
+
+			expected = ev[i].seq + 1;
+			last = ev[i].timestamp_ns;
+			first = 0;
+		}
+	}
+
+	perror("poll");
+	return EXIT_FAILURE;
+}
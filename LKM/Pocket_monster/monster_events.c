@@ -0,0 +1,181 @@
+/*
+ * Prints the events multicast by pocket_monster over generic netlink.
+ *
+ *   gcc -o monster_events monster_events.c
+ *   ./monster_events
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "pocket_monster.h"
+
+#define BUF_SIZE 65536
+
+static const char *mood_names[] = { "happy", "hungry", "angry", "sleepy" };
+
+void die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+#define GENL_DATA(gh)     ((char *)(gh) + GENL_HDRLEN)
+#define NLA_DATA(nla)     ((char *)(nla) + NLA_HDRLEN)
+#define NLA_NEXT(nla)     ((struct nlattr *)((char *)(nla) + NLA_ALIGN((nla)->nla_len)))
+#define NLA_OK(nla, rem)  ((rem) >= (int)sizeof(struct nlattr) && \
+			   (nla)->nla_len >= sizeof(struct nlattr) && (nla)->nla_len <= (rem))
+
+/* Fills tb[type] with the attributes of a stream, tb has max + 1 entries */
+static void parse_attrs(struct nlattr **tb, int max, struct nlattr *nla, int rem)
+{
+	memset(tb, 0, (max + 1) * sizeof(*tb));
+
+	for (; NLA_OK(nla, rem); rem -= NLA_ALIGN(nla->nla_len), nla = NLA_NEXT(nla)) {
+		int type = nla->nla_type & NLA_TYPE_MASK;
+
+		if (type <= max)
+			tb[type] = nla;
+	}
+}
+
+/* Asks the generic netlink controller for the id of the events group */
+static int resolve_group(int fd)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct genlmsghdr gh;
+		char attrs[64];
+	} req = { 0 };
+	struct nlattr *nla = (struct nlattr *)req.attrs;
+	struct nlattr *tb[CTRL_ATTR_MAX + 1], *grp;
+	static char buf[BUF_SIZE];
+	struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+	int len, rem;
+
+	nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+	nla->nla_len = NLA_HDRLEN + sizeof(MONSTER_GENL_NAME);
+	strcpy(NLA_DATA(nla), MONSTER_GENL_NAME);
+
+	req.nh.nlmsg_type = GENL_ID_CTRL;
+	req.nh.nlmsg_flags = NLM_F_REQUEST;
+	req.nh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(nla->nla_len);
+	req.gh.cmd = CTRL_CMD_GETFAMILY;
+	req.gh.version = 1;
+
+	if (send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+		die("send");
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0)
+		die("recv");
+	if (!NLMSG_OK(nh, len) || nh->nlmsg_type == NLMSG_ERROR) {
+		fprintf(stderr, "family %s not found, is pocket_monster loaded?\n",
+			MONSTER_GENL_NAME);
+		exit(EXIT_FAILURE);
+	}
+
+	parse_attrs(tb, CTRL_ATTR_MAX, (struct nlattr *)GENL_DATA(NLMSG_DATA(nh)),
+		    nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+	if (!tb[CTRL_ATTR_MCAST_GROUPS])
+		return -1;
+
+	/* A list of nests, each with a name and an id */
+	grp = (struct nlattr *)NLA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]);
+	rem = tb[CTRL_ATTR_MCAST_GROUPS]->nla_len - NLA_HDRLEN;
+	for (; NLA_OK(grp, rem); rem -= NLA_ALIGN(grp->nla_len), grp = NLA_NEXT(grp)) {
+		struct nlattr *gtb[CTRL_ATTR_MCAST_GRP_MAX + 1];
+
+		parse_attrs(gtb, CTRL_ATTR_MCAST_GRP_MAX, (struct nlattr *)NLA_DATA(grp),
+			    grp->nla_len - NLA_HDRLEN);
+		if (gtb[CTRL_ATTR_MCAST_GRP_NAME] && gtb[CTRL_ATTR_MCAST_GRP_ID] &&
+		    !strcmp(NLA_DATA(gtb[CTRL_ATTR_MCAST_GRP_NAME]), MONSTER_GENL_MCGRP_EVENTS))
+			return *(uint32_t *)NLA_DATA(gtb[CTRL_ATTR_MCAST_GRP_ID]);
+	}
+
+	return -1;
+}
+
+static void print_event(uint64_t tick, struct nlattr *nest)
+{
+	struct nlattr *tb[MONSTER_ATTR_MAX + 1];
+	uint32_t flags;
+
+	parse_attrs(tb, MONSTER_ATTR_MAX, (struct nlattr *)NLA_DATA(nest),
+		    nest->nla_len - NLA_HDRLEN);
+	if (!tb[MONSTER_ATTR_ID] || !tb[MONSTER_ATTR_FLAGS])
+		return;
+
+	flags = *(uint32_t *)NLA_DATA(tb[MONSTER_ATTR_FLAGS]);
+	printf("tick %llu id %u%s%s%s%s%s", (unsigned long long)tick,
+	       *(uint32_t *)NLA_DATA(tb[MONSTER_ATTR_ID]),
+	       flags & MONSTER_EV_BORN ? " born" : "",
+	       flags & MONSTER_EV_GONE ? " gone" : "",
+	       flags & MONSTER_EV_MOOD ? " mood" : "",
+	       flags & MONSTER_EV_HUNGER ? " hunger" : "",
+	       flags & MONSTER_EV_ENERGY ? " energy" : "");
+
+	if (tb[MONSTER_ATTR_MOOD] && *(uint8_t *)NLA_DATA(tb[MONSTER_ATTR_MOOD]) < 4)
+		printf(" mood=%s", mood_names[*(uint8_t *)NLA_DATA(tb[MONSTER_ATTR_MOOD])]);
+	if (tb[MONSTER_ATTR_HUNGER])
+		printf(" hunger=%u", *(uint8_t *)NLA_DATA(tb[MONSTER_ATTR_HUNGER]));
+	if (tb[MONSTER_ATTR_ENERGY])
+		printf(" energy=%u", *(uint8_t *)NLA_DATA(tb[MONSTER_ATTR_ENERGY]));
+	if (tb[MONSTER_ATTR_AGE])
+		printf(" age=%u", *(uint32_t *)NLA_DATA(tb[MONSTER_ATTR_AGE]));
+	printf("\n");
+}
+
+int main(void)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	static char buf[BUF_SIZE];
+	int fd, group;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (fd < 0)
+		die("socket");
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("bind");
+
+	group = resolve_group(fd);
+	if (group < 0) {
+		fprintf(stderr, "no %s group\n", MONSTER_GENL_MCGRP_EVENTS);
+		return EXIT_FAILURE;
+	}
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0)
+		die("setsockopt");
+
+	for (;;) {
+		int len = recv(fd, buf, sizeof(buf), 0);
+		struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+
+		if (len < 0) {
+			/* The socket buffer overflowed, some events are lost */
+			if (errno == ENOBUFS) {
+				fprintf(stderr, "[!] events lost\n");
+				continue;
+			}
+			die("recv");
+		}
+
+		for (; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			struct nlattr *nla = (struct nlattr *)GENL_DATA(NLMSG_DATA(nh));
+			int rem = nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+			uint64_t tick = 0;
+
+			for (; NLA_OK(nla, rem); rem -= NLA_ALIGN(nla->nla_len), nla = NLA_NEXT(nla)) {
+				if (nla->nla_type == MONSTER_ATTR_TICK)
+					memcpy(&tick, NLA_DATA(nla), sizeof(tick));
+				else if ((nla->nla_type & NLA_TYPE_MASK) == MONSTER_ATTR_EVENT)
+					print_event(tick, nla);
+			}
+		}
+	}
+}
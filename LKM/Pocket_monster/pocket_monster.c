@@ -1,21 +1,42 @@
 #define pr_fmt(fmt) "kernel_monster: " fmt
 
 #include <linux/init.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
 #include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/proc_fs.h>
+#include <linux/sched.h>
 #include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
+#include <linux/xarray.h>
+#include <net/genetlink.h>
+
+#include "pocket_monster.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("ECAM");
 MODULE_DESCRIPTION("A virtual kernel monster (pocket size)");
 MODULE_VERSION("1.0");
 
-#define MONSTER_NAME_LEN 32
-#define MONSTER_MOOD_LEN 16
+#define MONSTER_CMD_LEN  64
+/* Shard boundaries are multiples of this, so shards never share a cache line */
+#define MONSTER_SHARD_ALIGN 64
+/* Monsters covered by one seqcount, shards must not share one */
+#define MONSTER_SEQ_BLOCK   MONSTER_SHARD_ALIGN
+/* Ids mapped per hold of the xarray lock on restore */
+#define MONSTER_IDS_BATCH   1024
 
 
 /* ------------------------------------------------------------------------- */
@@ -34,21 +55,163 @@ static int energy = 90;
 module_param(energy, int, S_IRUGO);
 MODULE_PARM_DESC(energy, "Initial energy level (0-100)");
 
+static unsigned int max_monsters = 1 << 17;
+module_param(max_monsters, uint, S_IRUGO);
+MODULE_PARM_DESC(max_monsters, "Maximum number of monsters alive at once");
+
+static unsigned int tick_batch = 4096;
+module_param(tick_batch, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(tick_batch, "Monsters updated between two reschedule points of a tick");
+
+static unsigned int shards;
+module_param(shards, uint, S_IRUGO);
+MODULE_PARM_DESC(shards, "Parts of the population ticked in parallel (0: one per online CPU)");
+
+static unsigned int tick_period_us = 1000000;
+module_param(tick_period_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(tick_period_us, "Tick period in microseconds (at least 100), applied from the next tick");
+
+static char *tick_engine = "hrtimer";
+module_param(tick_engine, charp, S_IRUGO);
+MODULE_PARM_DESC(tick_engine, "What triggers a tick: hrtimer, slack (hrtimer allowed to fire up to tick_slack_us late) or deferrable (timer that does not wake an idle CPU)");
+
+static unsigned int tick_slack_us = 10000;
+module_param(tick_slack_us, uint, S_IRUGO);
+MODULE_PARM_DESC(tick_slack_us, "Delay the slack engine may add to a tick to group wakeups");
+
+static bool event_deltas = true;
+module_param(event_deltas, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(event_deltas, "Netlink events carry only the monsters and fields that changed (0: whole state every tick)");
+
 /* ------------------------------------------------------------------------- */
 /* Monster state                                                                 */
 /* ------------------------------------------------------------------------- */
 
-struct kernel_monster {
-	char name[MONSTER_NAME_LEN];
-	int hunger;
-	int energy;
-	int age;
-	char mood[MONSTER_MOOD_LEN];
+enum monster_mood {
+	MOOD_HAPPY,
+	MOOD_HUNGRY,
+	MOOD_ANGRY,
+	MOOD_SLEEPY,
+};
+
+static const char * const mood_names[] = {
+	[MOOD_HAPPY]  = "happy",
+	[MOOD_HUNGRY] = "hungry",
+	[MOOD_ANGRY]  = "angry",
+	[MOOD_SLEEPY] = "sleepy",
+};
+
+/* One monster, as shown to the user, is a struct kernel_monster */
+static_assert(sizeof(struct kernel_monster) == 64);
+
+/*
+ * The population is stored as a structure of arrays, packed in slots
+ * [0, count): a tick walks each small array linearly and the names, which
+ * it never reads, stay out of the cache. Destroying a monster moves the
+ * last one into its slot, so monsters have a stable id and the id to slot
+ * mapping lives in an xarray.
+ *
+ * Readers do not take monster_lock: each block of MONSTER_SEQ_BLOCK slots
+ * has a seqcount, bumped around every change to them, and a reader copies
+ * a monster again until it saw no change. The arrays are never resized.
+ *
+ * The arrays live in one vmalloc_user() area after a struct
+ * monster_map_header page, so that it can be mapped read-only by
+ * userspace through /proc/kernel_monster_snapshot.
+ */
+struct monster_population {
+	unsigned int count;
+	unsigned int capacity;
+	void *map;
+	size_t map_size;
+	struct monster_map_header *hdr;
+	seqcount_t *seq;
+	u32 *id;
+	u8 *hunger;
+	u8 *energy;
+	u8 *mood;
+	u32 *age;
+	char (*name)[MONSTER_NAME_LEN];
+};
+
+static struct monster_population pop;
+static DEFINE_XARRAY_ALLOC(monster_ids);
+static u32 monster_next_id;
+/* Serializes the tick against monster creation and destruction */
+static DEFINE_MUTEX(monster_lock);
+static u64 tick_count;
+
+/* One change of a monster, gathered while its block is updated */
+struct monster_event {
+	u32 id;
+	u32 flags;
+	u32 age;
+	u8 mood;
+	u8 hunger;
+	u8 energy;
 };
 
-static struct kernel_monster monster;
+/* A netlink message being filled, multicast when full */
+struct monster_events {
+	u64 tick;
+	bool full;
+	struct sk_buff *skb;
+	void *hdr;
+};
+
+static atomic64_t events_dropped;
+
+/* A slice of the population ticked by one work item */
+struct monster_shard {
+	struct work_struct work;
+	unsigned int start;
+	unsigned int end;
+	u64 last_ns;
+	u64 max_ns;
+	bool events_on;
+	struct monster_events events;
+	/* Changes of the block being ticked, too large for the stack */
+	struct monster_event evs[MONSTER_SEQ_BLOCK];
+};
+
+static struct monster_shard *monster_shards;
+static struct workqueue_struct *monster_wq;
+
+/* Tick statistics, updated under monster_lock */
+static u64 tick_last_ns;
+static u64 tick_max_ns;
+static u64 tick_overruns;
+static u64 jitter_last_ns;
+static u64 jitter_max_ns;
+static u64 jitter_sum_ns;
+/* Deadlines that passed without a tick of their own */
+static atomic64_t tick_missed;
+
+enum tick_engines {
+	TICK_HRTIMER,
+	TICK_SLACK,
+	TICK_DEFERRABLE,
+};
+
+static const char * const tick_engine_names[] = {
+	[TICK_HRTIMER]    = "hrtimer",
+	[TICK_SLACK]      = "slack",
+	[TICK_DEFERRABLE] = "deferrable",
+};
+
+static int engine;
+/* CLOCK_MONOTONIC time the next tick to run was due */
+static u64 tick_deadline;
+/* hrtimer engines: the timer queues monster_tick_work */
+static struct hrtimer monster_timer;
+static struct work_struct monster_tick_work;
+/* Deferrable engine */
 static struct delayed_work monster_work;
 static struct proc_dir_entry *monster_proc_entry;
+static struct proc_dir_entry *monster_ctl_entry;
+static struct proc_dir_entry *monster_stats_entry;
+static struct proc_dir_entry *monster_snapshot_entry;
+static struct dentry *monster_debugfs_dir;
 
 /* ------------------------------------------------------------------------- */
 /* Helpers                                                                   */
@@ -63,114 +226,1193 @@ static int clamp_value(int value, int min, int max)
 	return value;
 }
 
-static void update_mood(struct kernel_monster *p)
+static u8 monster_mood(int hunger, int energy)
+{
+	if (energy < 20)
+		return MOOD_SLEEPY;
+	if (hunger > 80)
+		return MOOD_ANGRY;
+	if (hunger > 50)
+		return MOOD_HUNGRY;
+	return MOOD_HAPPY;
+}
+
+static seqcount_t *monster_seq(unsigned int slot)
+{
+	return &pop.seq[slot / MONSTER_SEQ_BLOCK];
+}
+
+/*
+ * Writers of a block are serialized by monster_lock or by owning it in a
+ * shard. They must not be preempted, or a reader could spin on a block
+ * until they run again.
+ */
+static void monster_write_begin(unsigned int slot)
+{
+	preempt_disable();
+	write_seqcount_begin(monster_seq(slot));
+}
+
+static void monster_write_end(unsigned int slot)
+{
+	write_seqcount_end(monster_seq(slot));
+	preempt_enable();
+}
+
+static void monster_get(unsigned int slot, struct kernel_monster *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->id = pop.id[slot];
+	strscpy(p->name, pop.name[slot], sizeof(p->name));
+	p->hunger = pop.hunger[slot];
+	p->energy = pop.energy[slot];
+	p->age = pop.age[slot];
+	strscpy(p->mood, mood_names[pop.mood[slot]], sizeof(p->mood));
+}
+
+/* Lock-free copy of the monster of a slot, never torn */
+static void monster_read(unsigned int slot, struct kernel_monster *p)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(monster_seq(slot));
+		monster_get(slot, p);
+	} while (read_seqcount_retry(monster_seq(slot), seq));
+}
+
+/* ------------------------------------------------------------------------- */
+/* Netlink events                                                            */
+/* ------------------------------------------------------------------------- */
+
+static const struct genl_multicast_group monster_mcgrps[] = {
+	{ .name = MONSTER_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family monster_genl_family __ro_after_init = {
+	.name     = MONSTER_GENL_NAME,
+	.version  = MONSTER_GENL_VERSION,
+	.maxattr  = MONSTER_ATTR_MAX,
+	.module   = THIS_MODULE,
+	.mcgrps   = monster_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(monster_mcgrps),
+};
+
+/* Events are only gathered while someone listens */
+static bool monster_events_wanted(void)
+{
+	return genl_has_listeners(&monster_genl_family, &init_net, 0);
+}
+
+static void monster_events_init(struct monster_events *ev, u64 tick)
+{
+	ev->tick = tick;
+	ev->full = !READ_ONCE(event_deltas);
+	ev->skb = NULL;
+}
+
+static void monster_events_flush(struct monster_events *ev)
+{
+	if (!ev->skb)
+		return;
+
+	genlmsg_end(ev->skb, ev->hdr);
+	/* Fails if the last listener just left, the message is freed anyway */
+	genlmsg_multicast(&monster_genl_family, ev->skb, 0, 0, GFP_KERNEL);
+	ev->skb = NULL;
+}
+
+static int monster_events_put(struct monster_events *ev, const struct monster_event *e)
+{
+	bool all = !(e->flags & MONSTER_EV_GONE) && (ev->full || e->flags & MONSTER_EV_BORN);
+	struct nlattr *nest;
+
+	nest = nla_nest_start(ev->skb, MONSTER_ATTR_EVENT);
+	if (!nest)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(ev->skb, MONSTER_ATTR_ID, e->id) ||
+	    nla_put_u32(ev->skb, MONSTER_ATTR_FLAGS, e->flags) ||
+	    ((all || e->flags & MONSTER_EV_MOOD) &&
+	     nla_put_u8(ev->skb, MONSTER_ATTR_MOOD, e->mood)) ||
+	    ((all || e->flags & MONSTER_EV_HUNGER) &&
+	     nla_put_u8(ev->skb, MONSTER_ATTR_HUNGER, e->hunger)) ||
+	    ((all || e->flags & MONSTER_EV_ENERGY) &&
+	     nla_put_u8(ev->skb, MONSTER_ATTR_ENERGY, e->energy)) ||
+	    (all && nla_put_u32(ev->skb, MONSTER_ATTR_AGE, e->age))) {
+		nla_nest_cancel(ev->skb, nest);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(ev->skb, nest);
+	return 0;
+}
+
+static void monster_events_add(struct monster_events *ev, const struct monster_event *e)
+{
+	int tries;
+
+	for (tries = 0; tries < 2; tries++) {
+		if (!ev->skb) {
+			ev->skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+			if (!ev->skb)
+				break;
+
+			ev->hdr = genlmsg_put(ev->skb, 0, 0, &monster_genl_family, 0,
+					      MONSTER_CMD_EVENTS);
+			if (!ev->hdr || nla_put_u64_64bit(ev->skb, MONSTER_ATTR_TICK, ev->tick,
+							  MONSTER_ATTR_PAD)) {
+				nlmsg_free(ev->skb);
+				ev->skb = NULL;
+				break;
+			}
+		}
+
+		if (!monster_events_put(ev, e))
+			return;
+
+		/* The message is full: send it and start the next one */
+		monster_events_flush(ev);
+	}
+
+	atomic64_inc(&events_dropped);
+}
+
+static void monster_event_get(unsigned int slot, u32 flags, struct monster_event *e)
+{
+	e->id = pop.id[slot];
+	e->flags = flags;
+	e->age = pop.age[slot];
+	e->mood = pop.mood[slot];
+	e->hunger = pop.hunger[slot];
+	e->energy = pop.energy[slot];
+}
+
+/* What a tick from (h0, e0, m0) to (h, e, m) is worth telling */
+static u32 monster_changes(int h0, int e0, u8 m0, int h, int e, u8 m)
+{
+	u32 flags = 0;
+
+	if (m != m0)
+		flags |= MONSTER_EV_MOOD;
+	if ((h0 > 50) != (h > 50) || (h0 > 80) != (h > 80))
+		flags |= MONSTER_EV_HUNGER;
+	if ((e0 < 20) != (e < 20))
+		flags |= MONSTER_EV_ENERGY;
+
+	return flags;
+}
+
+/*
+ * Ticks the monsters of slots [start, end), one seqcount block at a time.
+ * The changes of a block are gathered in evs, MONSTER_SEQ_BLOCK entries,
+ * and added to ev, if any, once it is released.
+ */
+static void monster_tick(unsigned int start, unsigned int end, struct monster_events *ev,
+			 struct monster_event *evs)
+{
+	unsigned int i, n, stop;
+	u32 flags;
+	int h, e;
+	u8 m;
+
+	for (; start < end; start = stop) {
+		stop = min(end, ALIGN(start + 1, MONSTER_SEQ_BLOCK));
+		n = 0;
+
+		monster_write_begin(start);
+		for (i = start; i < stop; i++) {
+			h = clamp_value(pop.hunger[i] + 10, 0, 100);
+			e = clamp_value(pop.energy[i] - 5, 0, 100);
+			m = monster_mood(h, e);
+			flags = monster_changes(pop.hunger[i], pop.energy[i], pop.mood[i], h, e, m);
+
+			pop.age[i] += 1;
+			pop.hunger[i] = h;
+			pop.energy[i] = e;
+			pop.mood[i] = m;
+
+			if (ev && (flags || ev->full))
+				monster_event_get(i, flags, &evs[n++]);
+		}
+		monster_write_end(start);
+
+		for (i = 0; i < n; i++)
+			monster_events_add(ev, &evs[i]);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* Population                                                                */
+/* ------------------------------------------------------------------------- */
+
+/* Reserves a page aligned array of the map, returns its offset */
+static u64 map_reserve(size_t *size, size_t len)
 {
-	if (p->energy < 20)
-		strscpy(p->mood, "sleepy", sizeof(p->mood));
-	else if (p->hunger > 80)
-		strscpy(p->mood, "angry", sizeof(p->mood));
-	else if (p->hunger > 50)
-		strscpy(p->mood, "hungry", sizeof(p->mood));
+	u64 off = *size;
+
+	*size += PAGE_ALIGN(len);
+	return off;
+}
+
+static int population_alloc(unsigned int capacity)
+{
+	unsigned int i, blocks = DIV_ROUND_UP(capacity, MONSTER_SEQ_BLOCK);
+	struct monster_map_header hdr = {
+		.magic    = MONSTER_MAP_MAGIC,
+		.version  = MONSTER_MAP_VERSION,
+		.capacity = capacity,
+		.name_len = MONSTER_NAME_LEN,
+	};
+	size_t size = PAGE_SIZE;
+
+	hdr.id_off = map_reserve(&size, capacity * sizeof(*pop.id));
+	hdr.hunger_off = map_reserve(&size, capacity * sizeof(*pop.hunger));
+	hdr.energy_off = map_reserve(&size, capacity * sizeof(*pop.energy));
+	hdr.mood_off = map_reserve(&size, capacity * sizeof(*pop.mood));
+	hdr.age_off = map_reserve(&size, capacity * sizeof(*pop.age));
+	hdr.name_off = map_reserve(&size, capacity * sizeof(*pop.name));
+
+	pop.capacity = capacity;
+	pop.seq = kvcalloc(blocks, sizeof(*pop.seq), GFP_KERNEL);
+	/* Zeroed, nothing of the kernel leaks to the mapping */
+	pop.map = vmalloc_user(size);
+	if (!pop.seq || !pop.map)
+		return -ENOMEM;
+
+	pop.map_size = size;
+	pop.hdr = pop.map;
+	*pop.hdr = hdr;
+	pop.id = pop.map + hdr.id_off;
+	pop.hunger = pop.map + hdr.hunger_off;
+	pop.energy = pop.map + hdr.energy_off;
+	pop.mood = pop.map + hdr.mood_off;
+	pop.age = pop.map + hdr.age_off;
+	pop.name = pop.map + hdr.name_off;
+
+	for (i = 0; i < blocks; i++)
+		seqcount_init(&pop.seq[i]);
+
+	return 0;
+}
+
+static void population_free(void)
+{
+	kvfree(pop.seq);
+	vfree(pop.map);
+	xa_destroy(&monster_ids);
+}
+
+/* Published once the slots below count are complete */
+static void population_set_count(unsigned int count)
+{
+	smp_store_release(&pop.count, count);
+	WRITE_ONCE(pop.hdr->count, count);
+}
+
+/*
+ * The generation of the mapping is odd while the population changes,
+ * and different after each change. Writers hold monster_lock.
+ */
+static void population_change_begin(void)
+{
+	WRITE_ONCE(pop.hdr->generation, pop.hdr->generation + 1);
+	smp_wmb();
+}
+
+static void population_change_end(void)
+{
+	smp_wmb();
+	WRITE_ONCE(pop.hdr->generation, pop.hdr->generation + 1);
+}
+
+/* An empty name makes one from the id */
+static int monster_create(const char *mname, int h, int e, u32 *idp)
+{
+	unsigned int slot = pop.count;
+	u32 id;
+	int ret;
+
+	lockdep_assert_held(&monster_lock);
+
+	if (slot >= pop.capacity)
+		return -ENOSPC;
+
+	ret = xa_alloc_cyclic(&monster_ids, &id, xa_mk_value(slot), xa_limit_32b,
+			      &monster_next_id, GFP_KERNEL);
+	if (ret < 0)
+		return ret;
+
+	h = clamp_value(h, 0, 100);
+	e = clamp_value(e, 0, 100);
+
+	monster_write_begin(slot);
+	pop.id[slot] = id;
+	if (*mname)
+		strscpy(pop.name[slot], mname, MONSTER_NAME_LEN);
 	else
-		strscpy(p->mood, "happy", sizeof(p->mood));
+		snprintf(pop.name[slot], MONSTER_NAME_LEN, "%s-%u", name, id);
+	pop.hunger[slot] = h;
+	pop.energy[slot] = e;
+	pop.age[slot] = 0;
+	pop.mood[slot] = monster_mood(h, e);
+	monster_write_end(slot);
+
+	population_set_count(slot + 1);
+
+	if (idp)
+		*idp = id;
+
+	return 0;
 }
 
-static void monster_tick(struct kernel_monster *p)
+static int monster_destroy(u32 id)
 {
-	p->age += 1;
-	p->hunger += 10;
-	p->energy -= 5;
+	unsigned int slot, last;
+	void *entry;
+
+	lockdep_assert_held(&monster_lock);
+
+	entry = xa_erase(&monster_ids, id);
+	if (!entry)
+		return -ENOENT;
+
+	slot = xa_to_value(entry);
+	last = pop.count - 1;
+	population_set_count(last);
+	if (slot == last)
+		return 0;
+
+	/* Keep the population packed: the last monster takes the free slot */
+	monster_write_begin(slot);
+	pop.id[slot] = pop.id[last];
+	pop.hunger[slot] = pop.hunger[last];
+	pop.energy[slot] = pop.energy[last];
+	pop.mood[slot] = pop.mood[last];
+	pop.age[slot] = pop.age[last];
+	memcpy(pop.name[slot], pop.name[last], MONSTER_NAME_LEN);
+	monster_write_end(slot);
+
+	/* Replacing a present entry does not allocate */
+	xa_store(&monster_ids, pop.id[slot], xa_mk_value(slot), GFP_KERNEL);
 
-	p->hunger = clamp_value(p->hunger, 0, 100);
-	p->energy = clamp_value(p->energy, 0, 100);
+	return 0;
+}
 
-	update_mood(p);
+static void monster_clear(void)
+{
+	lockdep_assert_held(&monster_lock);
 
-	pr_info("Tick %d -- name=%s hunger=%d energy=%d mood=%s\n",
-		p->age, p->name, p->hunger, p->energy, p->mood);
+	xa_destroy(&monster_ids);
+	population_set_count(0);
 }
 
 /* ------------------------------------------------------------------------- */
-/* Delayed work                                                              */
+/* Checkpoint / restore                                                      */
 /* ------------------------------------------------------------------------- */
 
-static void monster_work_handler(struct work_struct *work)
+/* A checkpoint is a header followed by the arrays, see pocket_monster.h */
+#define MONSTER_CKPT_RECORD (2 * sizeof(u32) + 2 * sizeof(u8) + MONSTER_NAME_LEN)
+
+static size_t ckpt_size(unsigned int count)
 {
-	monster_tick(&monster);
+	return sizeof(struct monster_ckpt_header) + (size_t)count * MONSTER_CKPT_RECORD;
+}
 
-	/* Schedule again in 1000 ms */
-	schedule_delayed_work(&monster_work, msecs_to_jiffies(1000));
+static void monster_checkpoint(void *image)
+{
+	struct monster_ckpt_header *h = image;
+	unsigned int n = pop.count;
+	void *p = h + 1;
+
+	lockdep_assert_held(&monster_lock);
+
+	*h = (struct monster_ckpt_header) {
+		.magic    = MONSTER_CKPT_MAGIC,
+		.version  = MONSTER_CKPT_VERSION,
+		.count    = n,
+		.next_id  = monster_next_id,
+		.name_len = MONSTER_NAME_LEN,
+	};
+
+	memcpy(p, pop.id, n * sizeof(*pop.id));
+	p += n * sizeof(*pop.id);
+	memcpy(p, pop.age, n * sizeof(*pop.age));
+	p += n * sizeof(*pop.age);
+	memcpy(p, pop.hunger, n);
+	p += n;
+	memcpy(p, pop.energy, n);
+	p += n;
+	memcpy(p, pop.name, n * sizeof(*pop.name));
+}
+
+/*
+ * Maps the ids of slots [0, count), MONSTER_IDS_BATCH at a time so that
+ * the lock is not held across the whole population. Nodes are allocated
+ * outside the lock only when the xarray runs out of them, not per id.
+ */
+static int monster_ids_load(unsigned int count)
+{
+	XA_STATE(xas, &monster_ids, 0);
+	unsigned int slot = 0, stop;
+
+	while (slot < count) {
+		stop = min(count, slot + MONSTER_IDS_BATCH);
+
+		do {
+			xas_lock(&xas);
+			for (; slot < stop; slot++) {
+				xas_set(&xas, pop.id[slot]);
+				if (xas_load(&xas)) {
+					xas_set_err(&xas, -EINVAL);
+					break;
+				}
+
+				xas_store(&xas, xa_mk_value(slot));
+				if (xas_error(&xas))
+					break;
+				/* What xa_alloc() would do, the id is taken */
+				xas_clear_mark(&xas, XA_FREE_MARK);
+			}
+			/* The walk restarts from the root once relocked */
+			xas_pause(&xas);
+			xas_unlock(&xas);
+		} while (xas_nomem(&xas, GFP_KERNEL));
+
+		if (xas_error(&xas))
+			return xas_error(&xas);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* Replaces the population with a checkpoint checked by the caller */
+static int monster_restore(const void *image)
+{
+	const struct monster_ckpt_header *h = image;
+	unsigned int i, j, stop, n = h->count;
+	const u32 *id = (const u32 *)(h + 1);
+	const u32 *age = id + n;
+	const u8 *hg = (const u8 *)(age + n);
+	const u8 *en = hg + n;
+	const char (*nm)[MONSTER_NAME_LEN] = (const void *)(en + n);
+	int ret;
+
+	lockdep_assert_held(&monster_lock);
+
+	monster_clear();
+
+	/* Whole blocks at a time, lock-free readers may still look at them */
+	for (i = 0; i < n; i = stop) {
+		stop = min(n, i + MONSTER_SEQ_BLOCK);
+
+		monster_write_begin(i);
+		memcpy(&pop.id[i], &id[i], (stop - i) * sizeof(*id));
+		memcpy(&pop.age[i], &age[i], (stop - i) * sizeof(*age));
+		memcpy(&pop.name[i], &nm[i], (stop - i) * sizeof(*nm));
+		for (j = i; j < stop; j++) {
+			pop.hunger[j] = min_t(u8, hg[j], 100);
+			pop.energy[j] = min_t(u8, en[j], 100);
+			pop.mood[j] = monster_mood(pop.hunger[j], pop.energy[j]);
+			pop.name[j][MONSTER_NAME_LEN - 1] = '\0';
+		}
+		monster_write_end(i);
+
+		if (!(i % (16 * MONSTER_SEQ_BLOCK)))
+			cond_resched();
+	}
+
+	ret = monster_ids_load(n);
+	if (ret) {
+		/* Duplicate id or no memory, leave a consistent empty population */
+		monster_clear();
+		return ret;
+	}
+
+	monster_next_id = h->next_id;
+	population_set_count(n);
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Tick                                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void monster_shard_handler(struct work_struct *work)
+{
+	struct monster_shard *shard = container_of(work, struct monster_shard, work);
+	struct monster_events *ev = shard->events_on ? &shard->events : NULL;
+	unsigned int batch = max(READ_ONCE(tick_batch), 1U);
+	u64 t0 = ktime_get_ns();
+	unsigned int start;
+
+	/* The tick in progress, tick_count is bumped once all shards are done */
+	if (ev)
+		monster_events_init(ev, READ_ONCE(tick_count) + 1);
+
+	/* In batches, so a large shard does not hog its CPU */
+	for (start = shard->start; start < shard->end; start += batch) {
+		monster_tick(start, min(start + batch, shard->end), ev, shard->evs);
+		cond_resched();
+	}
+
+	if (ev)
+		monster_events_flush(ev);
+
+	WRITE_ONCE(shard->last_ns, ktime_get_ns() - t0);
+	WRITE_ONCE(shard->max_ns, max(shard->max_ns, shard->last_ns));
+}
+
+static u64 tick_period_ns(void)
+{
+	return (u64)max(READ_ONCE(tick_period_us), 100U) * NSEC_PER_USEC;
+}
+
+/* Ticks the whole population, for the deadline given */
+static void monster_tick_run(u64 deadline)
+{
+	unsigned int i, per_shard, start = 0;
+	bool events_on = monster_events_wanted();
+	u64 t0 = ktime_get_ns();
+	u64 jitter = t0 > deadline ? t0 - deadline : 0;
+
+	/*
+	 * Creation and destruction wait for the end of the tick, so the
+	 * shards own their slices until they are all flushed.
+	 */
+	mutex_lock(&monster_lock);
+	population_change_begin();
+
+	per_shard = ALIGN(DIV_ROUND_UP(pop.count, shards), MONSTER_SHARD_ALIGN);
+	for (i = 0; i < shards; i++) {
+		WRITE_ONCE(monster_shards[i].start, start);
+		WRITE_ONCE(monster_shards[i].end, min(start + per_shard, pop.count));
+		start = monster_shards[i].end;
+		monster_shards[i].events_on = events_on;
+		queue_work(monster_wq, &monster_shards[i].work);
+	}
+	for (i = 0; i < shards; i++)
+		flush_work(&monster_shards[i].work);
+
+	population_change_end();
+
+	WRITE_ONCE(tick_count, tick_count + 1);
+	WRITE_ONCE(tick_last_ns, ktime_get_ns() - t0);
+	WRITE_ONCE(tick_max_ns, max(tick_max_ns, tick_last_ns));
+	if (tick_last_ns > tick_period_ns())
+		WRITE_ONCE(tick_overruns, tick_overruns + 1);
+	WRITE_ONCE(jitter_last_ns, jitter);
+	WRITE_ONCE(jitter_max_ns, max(jitter_max_ns, jitter));
+	WRITE_ONCE(jitter_sum_ns, jitter_sum_ns + jitter);
+
+	mutex_unlock(&monster_lock);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Tick engines                                                              */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Deadlines are absolute and follow each other by exactly one period,
+ * however late a tick ran: the time a tick takes does not delay the next
+ * one. Deadlines already past when the next one is computed are skipped
+ * and counted as missed.
+ */
+static enum hrtimer_restart monster_hrtimer_fn(struct hrtimer *timer)
+{
+	u64 missed;
+
+	WRITE_ONCE(tick_deadline, ktime_to_ns(hrtimer_get_softexpires(timer)));
+
+	/* Still pending: the tick due one period ago has not even started */
+	if (!queue_work(monster_wq, &monster_tick_work))
+		atomic64_inc(&tick_missed);
+
+	missed = hrtimer_forward_now(timer, ns_to_ktime(tick_period_ns()));
+	if (missed > 1)
+		atomic64_add(missed - 1, &tick_missed);
+
+	return HRTIMER_RESTART;
+}
+
+static void monster_tick_work_handler(struct work_struct *work)
+{
+	monster_tick_run(READ_ONCE(tick_deadline));
+}
+
+static void monster_deferrable_handler(struct work_struct *work)
+{
+	u64 period = tick_period_ns(), deadline = tick_deadline, now, missed;
+
+	monster_tick_run(deadline);
+
+	now = ktime_get_ns();
+	deadline += period;
+	if (deadline <= now) {
+		missed = div64_u64(now - deadline, period) + 1;
+		atomic64_add(missed, &tick_missed);
+		deadline += missed * period;
+	}
+	tick_deadline = deadline;
+
+	/* Rounded up, a jiffy timer must not fire before the deadline */
+	queue_delayed_work(monster_wq, &monster_work,
+			   usecs_to_jiffies(div_u64(deadline - now, NSEC_PER_USEC) + 1));
+}
+
+static void monster_engine_start(void)
+{
+	u64 period = tick_period_ns();
+
+	tick_deadline = ktime_get_ns() + period;
+
+	if (engine == TICK_DEFERRABLE) {
+		INIT_DEFERRABLE_WORK(&monster_work, monster_deferrable_handler);
+		queue_delayed_work(monster_wq, &monster_work,
+				   usecs_to_jiffies(div_u64(period, NSEC_PER_USEC)));
+		return;
+	}
+
+	INIT_WORK(&monster_tick_work, monster_tick_work_handler);
+	hrtimer_init(&monster_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	monster_timer.function = monster_hrtimer_fn;
+
+	/* The slack is kept by hrtimer_forward_now() for every later deadline */
+	hrtimer_start_range_ns(&monster_timer, ns_to_ktime(tick_deadline),
+			       engine == TICK_SLACK ? (u64)tick_slack_us * NSEC_PER_USEC : 0,
+			       HRTIMER_MODE_ABS);
+}
+
+static void monster_engine_stop(void)
+{
+	if (engine == TICK_DEFERRABLE) {
+		cancel_delayed_work_sync(&monster_work);
+		return;
+	}
+
+	hrtimer_cancel(&monster_timer);
+	cancel_work_sync(&monster_tick_work);
 }
 
 /* ------------------------------------------------------------------------- */
 /* /proc interface                                                           */
 /* ------------------------------------------------------------------------- */
 
-static int monster_proc_show(struct seq_file *m, void *v)
+/*
+ * One line per record, the column titles being record 0 and the monster
+ * of slot i record i + 1. Every field is printed at its full width, so
+ * every line is MONSTER_LINE_LEN bytes long and a file offset maps
+ * directly to a record.
+ */
+#define MONSTER_TITLE_FMT "%-10s %-32s %10s %6s %6s %-6s\n"
+#define MONSTER_LINE_FMT  "%-10u %-32s %10u %6d %6d %-6s\n"
+#define MONSTER_LINE_LEN  76
+
+/* Formats record rec into line, returns false past the last monster */
+static bool monster_line(u64 rec, char *line)
 {
-	seq_printf(m, "name: %s\n", monster.name);
-	seq_printf(m, "age: %d\n", monster.age);
-	seq_printf(m, "hunger: %d\n", monster.hunger);
-	seq_printf(m, "energy: %d\n", monster.energy);
-	seq_printf(m, "mood: %s\n", monster.mood);
+	struct kernel_monster monster;
 
-	return 0;
+	if (!rec) {
+		snprintf(line, MONSTER_LINE_LEN + 1, MONSTER_TITLE_FMT, "id",
+			 "name", "age", "hunger", "energy", "mood");
+		return true;
+	}
+	if (rec > smp_load_acquire(&pop.count))
+		return false;
+
+	monster_read(rec - 1, &monster);
+	snprintf(line, MONSTER_LINE_LEN + 1, MONSTER_LINE_FMT, monster.id,
+		 monster.name, monster.age, monster.hunger, monster.energy,
+		 monster.mood);
+	return true;
 }
 
-static int monster_proc_open(struct inode *inode, struct file *file)
+/*
+ * Lines are generated a page at a time, starting at the record the file
+ * offset falls in, so seeking anywhere costs nothing: the records before
+ * it are never rendered.
+ */
+static ssize_t monster_proc_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
 {
-	return single_open(file, monster_proc_show, NULL);
+	char line[MONSTER_LINE_LEN + 1];
+	size_t done = 0, len = 0;
+	u32 off;
+	u64 rec;
+	char *page;
+
+	if (*ppos < 0)
+		return -EINVAL;
+
+	page = (char *)__get_free_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	rec = div_u64_rem(*ppos, MONSTER_LINE_LEN, &off);
+	while (done + len < count) {
+		size_t n;
+
+		if (len + MONSTER_LINE_LEN - off > PAGE_SIZE) {
+			if (copy_to_user(buf + done, page, len))
+				break;
+			done += len;
+			len = 0;
+			cond_resched();
+		}
+		if (!monster_line(rec++, line))
+			break;
+
+		n = min_t(size_t, MONSTER_LINE_LEN - off, count - done - len);
+		memcpy(page + len, line + off, n);
+		len += n;
+		off = 0;
+	}
+
+	if (len && !copy_to_user(buf + done, page, len))
+		done += len;
+	free_page((unsigned long)page);
+
+	if (!done && count && len)
+		return -EFAULT;
+
+	*ppos += done;
+	return done;
 }
 
 static const struct proc_ops monster_proc_ops = {
-	.proc_open    = monster_proc_open,
+	.proc_read    = monster_proc_read,
+	.proc_lseek   = default_llseek,
+};
+
+/*
+ * Commands written to /proc/kernel_monster_ctl:
+ *   create NAME [HUNGER ENERGY]
+ *   spawn COUNT
+ *   destroy ID
+ *   clear
+ */
+static ssize_t monster_ctl_write(struct file *file, const char __user *buf,
+				 size_t len, loff_t *off)
+{
+	char cmd[MONSTER_CMD_LEN], mname[MONSTER_NAME_LEN];
+	struct monster_events events, *ev = NULL;
+	struct monster_event event;
+	unsigned int count, i;
+	int h = hunger, e = energy;
+	char *arg;
+	u32 id;
+	int ret;
+
+	if (len >= sizeof(cmd))
+		return -EINVAL;
+	if (copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	cmd[len] = '\0';
+
+	arg = strim(cmd);
+
+	mutex_lock(&monster_lock);
+	population_change_begin();
+
+	if (monster_events_wanted()) {
+		ev = &events;
+		monster_events_init(ev, tick_count);
+	}
+
+	if (sscanf(arg, "create %31s %d %d", mname, &h, &e) >= 1) {
+		ret = monster_create(mname, h, e, &id);
+		if (!ret) {
+			pr_info("A new monster named %s was born! (id %u)\n", mname, id);
+			if (ev) {
+				monster_event_get(pop.count - 1, MONSTER_EV_BORN, &event);
+				monster_events_add(ev, &event);
+			}
+		}
+	} else if (sscanf(arg, "spawn %u", &count) == 1) {
+		for (ret = 0, i = 0; i < count && !ret; i++) {
+			ret = monster_create("", hunger, energy, NULL);
+			if (!ret && ev) {
+				monster_event_get(pop.count - 1, MONSTER_EV_BORN, &event);
+				monster_events_add(ev, &event);
+			}
+			if (!(i % 1024))
+				cond_resched();
+		}
+		pr_info("%u monsters spawned, %u alive\n", ret ? i - 1 : i, pop.count);
+	} else if (sscanf(arg, "destroy %u", &id) == 1) {
+		ret = monster_destroy(id);
+		if (!ret && ev) {
+			event.id = id;
+			event.flags = MONSTER_EV_GONE;
+			monster_events_add(ev, &event);
+		}
+	} else if (!strcmp(arg, "clear")) {
+		for (i = 0; ev && i < pop.count; i++) {
+			monster_event_get(i, MONSTER_EV_GONE, &event);
+			monster_events_add(ev, &event);
+		}
+		monster_clear();
+		ret = 0;
+	} else {
+		ret = -EINVAL;
+	}
+
+	population_change_end();
+
+	if (ev)
+		monster_events_flush(ev);
+
+	mutex_unlock(&monster_lock);
+
+	return ret ? ret : len;
+}
+
+static const struct proc_ops monster_ctl_ops = {
+	.proc_write   = monster_ctl_write,
+};
+
+static int monster_stats_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	/* Lock-free too, the values may come from two different ticks */
+	seq_printf(m, "monsters: %u\n", READ_ONCE(pop.count));
+	seq_printf(m, "ticks: %llu\n", READ_ONCE(tick_count));
+	seq_printf(m, "engine: %s\n", tick_engine_names[engine]);
+	seq_printf(m, "period_ns: %llu\n", tick_period_ns());
+	seq_printf(m, "last_ns: %llu\n", READ_ONCE(tick_last_ns));
+	seq_printf(m, "max_ns: %llu\n", READ_ONCE(tick_max_ns));
+	seq_printf(m, "overruns: %llu\n", READ_ONCE(tick_overruns));
+	seq_printf(m, "missed: %lld\n", atomic64_read(&tick_missed));
+	seq_printf(m, "jitter_last_ns: %llu\n", READ_ONCE(jitter_last_ns));
+	seq_printf(m, "jitter_max_ns: %llu\n", READ_ONCE(jitter_max_ns));
+	seq_printf(m, "jitter_avg_ns: %llu\n",
+		   div64_u64(READ_ONCE(jitter_sum_ns), max(READ_ONCE(tick_count), 1ULL)));
+	seq_printf(m, "events_dropped: %lld\n", atomic64_read(&events_dropped));
+
+	seq_printf(m, "%-6s %10s %10s %12s %12s\n", "shard", "start", "end",
+		   "last_ns", "max_ns");
+	for (i = 0; i < shards; i++)
+		seq_printf(m, "%-6u %10u %10u %12llu %12llu\n", i,
+			   READ_ONCE(monster_shards[i].start), READ_ONCE(monster_shards[i].end),
+			   READ_ONCE(monster_shards[i].last_ns),
+			   READ_ONCE(monster_shards[i].max_ns));
+
+	return 0;
+}
+
+static int monster_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, monster_stats_show, NULL);
+}
+
+static const struct proc_ops monster_stats_ops = {
+	.proc_open    = monster_stats_open,
 	.proc_read    = seq_read,
 	.proc_lseek   = seq_lseek,
 	.proc_release = single_release,
 };
 
+/*
+ * /proc/kernel_monster_snapshot returns the population as an array of
+ * struct kernel_monster, each one copied without tearing. The offset
+ * must be a multiple of the record size, and so the length at least one.
+ */
+static ssize_t monster_snapshot_read(struct file *file, char __user *buf,
+				     size_t len, loff_t *off)
+{
+	struct kernel_monster monster;
+	size_t done = 0;
+	loff_t slot;
+
+	if (*off % sizeof(monster) || len < sizeof(monster))
+		return -EINVAL;
+
+	for (slot = *off / sizeof(monster);
+	     done + sizeof(monster) <= len && slot < smp_load_acquire(&pop.count);
+	     slot++, done += sizeof(monster)) {
+		monster_read(slot, &monster);
+		if (copy_to_user(buf + done, &monster, sizeof(monster)))
+			return done ? done : -EFAULT;
+
+		if (!(slot % 1024)) {
+			if (fatal_signal_pending(current))
+				break;
+			cond_resched();
+		}
+	}
+
+	*off += done;
+	return done;
+}
+
+/*
+ * Mapping /proc/kernel_monster_snapshot gives the struct monster_map_header
+ * page followed by the state arrays, read-only.
+ */
+static int monster_snapshot_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, pop.map, vma->vm_pgoff);
+}
+
+static const struct proc_ops monster_snapshot_ops = {
+	.proc_read    = monster_snapshot_read,
+	.proc_lseek   = default_llseek,
+	.proc_mmap    = monster_snapshot_mmap,
+};
+
+/*
+ * debugfs kernel_monster/checkpoint. Opening it for reading takes a
+ * checkpoint of the population, read back from the buffer. Opening it for
+ * writing makes a buffer for the largest checkpoint, and the population is
+ * replaced as soon as a complete one has been written to it.
+ */
+struct ckpt_buf {
+	void *data;
+	size_t len;
+	size_t size;
+};
+
+static int ckpt_open(struct inode *inode, struct file *file)
+{
+	struct ckpt_buf *c;
+
+	if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+		return -EINVAL;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	if (file->f_mode & FMODE_WRITE) {
+		c->size = ckpt_size(pop.capacity);
+		c->data = kvmalloc(c->size, GFP_KERNEL);
+	} else {
+		mutex_lock(&monster_lock);
+		c->size = ckpt_size(pop.count);
+		c->data = kvmalloc(c->size, GFP_KERNEL);
+		if (c->data)
+			monster_checkpoint(c->data);
+		c->len = c->size;
+		mutex_unlock(&monster_lock);
+	}
+
+	if (!c->data) {
+		kfree(c);
+		return -ENOMEM;
+	}
+
+	file->private_data = c;
+	return 0;
+}
+
+static ssize_t ckpt_read(struct file *file, char __user *buf, size_t len, loff_t *off)
+{
+	struct ckpt_buf *c = file->private_data;
+
+	return simple_read_from_buffer(buf, len, off, c->data, c->len);
+}
+
+static ssize_t ckpt_write(struct file *file, const char __user *buf, size_t len, loff_t *off)
+{
+	struct ckpt_buf *c = file->private_data;
+	const struct monster_ckpt_header *h = c->data;
+	ssize_t ret;
+	int err;
+
+	/* Written in one go, in order */
+	if (*off != c->len)
+		return -EINVAL;
+
+	ret = simple_write_to_buffer(c->data, c->size, off, buf, len);
+	if (ret <= 0)
+		return ret ? ret : -EFBIG;
+	c->len = *off;
+
+	if (c->len < sizeof(*h))
+		return ret;
+
+	if (h->magic != MONSTER_CKPT_MAGIC || h->version != MONSTER_CKPT_VERSION ||
+	    h->name_len != MONSTER_NAME_LEN || h->count > pop.capacity ||
+	    c->len > ckpt_size(h->count))
+		return -EINVAL;
+	if (c->len < ckpt_size(h->count))
+		return ret;
+
+	mutex_lock(&monster_lock);
+	population_change_begin();
+	err = monster_restore(c->data);
+	population_change_end();
+	mutex_unlock(&monster_lock);
+
+	if (err)
+		return err;
+
+	pr_info("%u monsters restored\n", h->count);
+	return ret;
+}
+
+static int ckpt_release(struct inode *inode, struct file *file)
+{
+	struct ckpt_buf *c = file->private_data;
+
+	kvfree(c->data);
+	kfree(c);
+	return 0;
+}
+
+static const struct file_operations ckpt_fops = {
+	.owner   = THIS_MODULE,
+	.open    = ckpt_open,
+	.read    = ckpt_read,
+	.write   = ckpt_write,
+	.release = ckpt_release,
+	.llseek  = default_llseek,
+};
+
 /* ------------------------------------------------------------------------- */
 /* Module init / exit                                                        */
 /* ------------------------------------------------------------------------- */
 
 static int __init kernel_monster_init(void)
 {
+	struct kernel_monster monster;
+	unsigned int i;
+	int ret;
+
 	hunger = clamp_value(hunger, 0, 100);
 	energy = clamp_value(energy, 0, 100);
 
-	strscpy(monster.name, name, sizeof(monster.name));
-	monster.hunger = hunger;
-	monster.energy = energy;
-	monster.age = 0;
-	update_mood(&monster);
+	if (!max_monsters)
+		return -EINVAL;
+
+	engine = match_string(tick_engine_names, ARRAY_SIZE(tick_engine_names), tick_engine);
+	if (engine < 0) {
+		pr_err("Unknown tick_engine %s\n", tick_engine);
+		return engine;
+	}
+
+	if (!shards)
+		shards = num_online_cpus();
+
+	ret = population_alloc(max_monsters);
+	if (ret)
+		goto err_free;
+
+	monster_shards = kcalloc(shards, sizeof(*monster_shards), GFP_KERNEL);
+	if (!monster_shards) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	for (i = 0; i < shards; i++)
+		INIT_WORK(&monster_shards[i].work, monster_shard_handler);
+
+	/* Unbound: the shards run in parallel on whichever CPUs are idle */
+	monster_wq = alloc_workqueue("kernel_monster", WQ_UNBOUND, 0);
+	if (!monster_wq) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	/* The first monster comes from the module parameters */
+	mutex_lock(&monster_lock);
+	ret = monster_create(name, hunger, energy, NULL);
+	if (!ret)
+		monster_get(0, &monster);
+	mutex_unlock(&monster_lock);
+	if (ret)
+		goto err_free;
 
 	pr_info("A new monster named %s was born!\n", monster.name);
 	pr_info("Initial state -- hunger=%d energy=%d mood=%s\n",
 		monster.hunger, monster.energy, monster.mood);
 
-	/* Create /proc entry */
+	ret = genl_register_family(&monster_genl_family);
+	if (ret) {
+		pr_err("Failed to register the %s netlink family\n", MONSTER_GENL_NAME);
+		goto err_free;
+	}
+
+	/* Create /proc entries */
 	monster_proc_entry = proc_create("kernel_monster", S_IRUGO, NULL, &monster_proc_ops);
 	if (!monster_proc_entry) {
 		pr_err("Failed to create /proc/kernel_monster\n");
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto err_genl;
+	}
+
+	monster_ctl_entry = proc_create("kernel_monster_ctl", S_IWUSR, NULL, &monster_ctl_ops);
+	if (!monster_ctl_entry) {
+		pr_err("Failed to create /proc/kernel_monster_ctl\n");
+		ret = -ENOMEM;
+		goto err_proc;
+	}
+
+	monster_stats_entry = proc_create("kernel_monster_stats", S_IRUGO, NULL,
+					  &monster_stats_ops);
+	if (!monster_stats_entry) {
+		pr_err("Failed to create /proc/kernel_monster_stats\n");
+		ret = -ENOMEM;
+		goto err_ctl;
 	}
 
+	monster_snapshot_entry = proc_create("kernel_monster_snapshot", S_IRUGO, NULL,
+					     &monster_snapshot_ops);
+	if (!monster_snapshot_entry) {
+		pr_err("Failed to create /proc/kernel_monster_snapshot\n");
+		ret = -ENOMEM;
+		goto err_stats;
+	}
+
+	monster_debugfs_dir = debugfs_create_dir("kernel_monster", NULL);
+	debugfs_create_file("checkpoint", S_IRUSR | S_IWUSR, monster_debugfs_dir, NULL,
+			    &ckpt_fops);
+
 	/* Start periodic updates */
-	INIT_DELAYED_WORK(&monster_work, monster_work_handler);
-	schedule_delayed_work(&monster_work, msecs_to_jiffies(1000));
+	monster_engine_start();
 
 	return 0;
+
+err_stats:
+	proc_remove(monster_stats_entry);
+err_ctl:
+	proc_remove(monster_ctl_entry);
+err_proc:
+	proc_remove(monster_proc_entry);
+err_genl:
+	genl_unregister_family(&monster_genl_family);
+err_free:
+	if (monster_wq)
+		destroy_workqueue(monster_wq);
+	kfree(monster_shards);
+	population_free();
+	return ret;
 }
 
 static void __exit kernel_monster_exit(void)
 {
-	cancel_delayed_work_sync(&monster_work);
+	debugfs_remove_recursive(monster_debugfs_dir);
+	monster_engine_stop();
+	destroy_workqueue(monster_wq);
+
+	proc_remove(monster_snapshot_entry);
+	proc_remove(monster_stats_entry);
+	proc_remove(monster_ctl_entry);
+	proc_remove(monster_proc_entry);
+	genl_unregister_family(&monster_genl_family);
 
-	if (monster_proc_entry)
-		proc_remove(monster_proc_entry);
+	pr_info("%u monsters have left the kernel world.\n", pop.count);
 
-	pr_info("%s has left the kernel world.\n", monster.name);
+	kfree(monster_shards);
+	population_free();
 }
 
 module_init(kernel_monster_init);
-module_exit(kernel_monster_exit);
\ No newline at end of file
+module_exit(kernel_monster_exit);
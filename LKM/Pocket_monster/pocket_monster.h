@@ -0,0 +1,106 @@
+/*
+ * Interfaces of pocket_monster shared with userspace: the generic netlink
+ * events, the records read from /proc/kernel_monster_snapshot and the
+ * layout of its mapping.
+ *
+ * Every message of the "events" multicast group is a MONSTER_CMD_EVENTS
+ * carrying the tick it belongs to and a list of MONSTER_ATTR_EVENT nests,
+ * one per monster that changed.
+ */
+#ifndef POCKET_MONSTER_H
+#define POCKET_MONSTER_H
+
+#include <linux/types.h>
+
+#define MONSTER_NAME_LEN 32
+#define MONSTER_MOOD_LEN 16
+
+/* 64 bytes record returned by read() on /proc/kernel_monster_snapshot */
+struct kernel_monster {
+	__u32 id;
+	char name[MONSTER_NAME_LEN];
+	__s32 hunger;
+	__s32 energy;
+	__u32 age;
+	char mood[MONSTER_MOOD_LEN];    /* happy, hungry, angry or sleepy */
+};
+
+#define MONSTER_GENL_NAME         "kernel_monster"
+#define MONSTER_GENL_VERSION      1
+#define MONSTER_GENL_MCGRP_EVENTS "events"
+
+enum {
+	MONSTER_CMD_UNSPEC,
+	MONSTER_CMD_EVENTS,
+	__MONSTER_CMD_MAX,
+};
+#define MONSTER_CMD_MAX (__MONSTER_CMD_MAX - 1)
+
+enum {
+	MONSTER_ATTR_UNSPEC,
+	MONSTER_ATTR_TICK,      /* u64 */
+	MONSTER_ATTR_EVENT,     /* nest of the attributes below */
+	MONSTER_ATTR_ID,        /* u32 */
+	MONSTER_ATTR_FLAGS,     /* u32, MONSTER_EV_* */
+	MONSTER_ATTR_MOOD,      /* u8, index in happy/hungry/angry/sleepy */
+	MONSTER_ATTR_HUNGER,    /* u8 */
+	MONSTER_ATTR_ENERGY,    /* u8 */
+	MONSTER_ATTR_AGE,       /* u32 */
+	MONSTER_ATTR_PAD,
+	__MONSTER_ATTR_MAX,
+};
+#define MONSTER_ATTR_MAX (__MONSTER_ATTR_MAX - 1)
+
+/* Why a monster is in an event */
+#define MONSTER_EV_BORN   (1U << 0)
+#define MONSTER_EV_GONE   (1U << 1)
+#define MONSTER_EV_MOOD   (1U << 2)  /* mood changed */
+#define MONSTER_EV_HUNGER (1U << 3)  /* hunger went over or under 50 or 80 */
+#define MONSTER_EV_ENERGY (1U << 4)  /* energy went over or under 20 */
+
+/*
+ * First page of the mapping. The arrays follow at the given offsets, each
+ * with capacity entries of which the first count are alive.
+ *
+ * generation is odd while the kernel changes the population (a tick or a
+ * command), a copy is consistent if it was even and unchanged around it.
+ */
+#define MONSTER_MAP_MAGIC   0x4d4f4e53  /* "MONS" */
+#define MONSTER_MAP_VERSION 1
+
+struct monster_map_header {
+	__u32 magic;
+	__u32 version;
+	__u64 generation;
+	__u32 count;
+	__u32 capacity;
+	__u32 name_len;
+	__u32 reserved;
+	__u64 id_off;           /* __u32 */
+	__u64 hunger_off;       /* __u8 */
+	__u64 energy_off;       /* __u8 */
+	__u64 mood_off;         /* __u8, index in happy/hungry/angry/sleepy */
+	__u64 age_off;          /* __u32 */
+	__u64 name_off;         /* char[name_len] */
+};
+
+/*
+ * Checkpoint of the population, read from and written to the debugfs file
+ * kernel_monster/checkpoint. The header is followed by count entries of
+ * each of these arrays, in this order, without padding:
+ *   __u32 id, __u32 age, __u8 hunger, __u8 energy, char name[name_len]
+ * The mood is computed again on restore.
+ */
+#define MONSTER_CKPT_MAGIC   0x504b434d  /* "MCKP" */
+#define MONSTER_CKPT_VERSION 1
+
+struct monster_ckpt_header {
+	__u32 magic;
+	__u32 version;
+	__u32 count;
+	__u32 next_id;          /* next id handed out on creation */
+	__u32 name_len;
+	__u32 reserved;
+};
+
+#endif /* POCKET_MONSTER_H */
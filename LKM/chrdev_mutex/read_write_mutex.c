@@ -3,16 +3,16 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/uaccess.h>
-#include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/errno.h>
 
 #define DRIVER_NAME "MyChrDevice"
 #define DRIVER_CLASS "MyModuleClass"
 
-/* Static definition  and initialisation of a mutex. */
-// static DEFINE_MUTEX(my_mutex_name);
-/* Dynamic mutex definition. Requires a mutex_init() to be initialised. */
-static struct mutex my_dyn_mutex;
+/* Reader/writer semaphore protecting the buffer. Any number of readers can
+ * hold it at once, a writer holds it alone and only while copying.
+ * Static alternative: static DECLARE_RWSEM(my_rwsem); */
+static struct rw_semaphore my_rwsem;
 
 /* Meta information */
 MODULE_LICENSE("GPL");
@@ -21,7 +21,7 @@ MODULE_DESCRIPTION("Read and write on a device.");
 
 /* Buffer for data */
 static char buffer[255];
-static int buffer_pointer = 0;
+static size_t buffer_pointer = 0;
 
 /* Vars for device and device class */
 static dev_t my_device_number;
@@ -30,13 +30,18 @@ static struct cdev my_device;
 
 /* Read callback */
 static ssize_t driver_read(struct file *File, char *user_buffer, size_t count, loff_t *offs) {
-	int to_copy, not_copied, delta;
+	size_t to_copy, not_copied, delta;
+
+	/* Shared lock: readers only wait for a writer in the middle of a copy. */
+	if (down_read_killable(&my_rwsem))
+		return -EINTR;
 
 	/* Amount of data to copy */
 	to_copy = min(count, buffer_pointer);
 
 	/* Copy data to user, returns the amount of byte that weren't copied. */
 	not_copied = copy_to_user(user_buffer, buffer, to_copy);
+	up_read(&my_rwsem);
 
 	/* Calculate delta */
 	delta = to_copy - not_copied;
@@ -46,7 +51,11 @@ static ssize_t driver_read(struct file *File, char *user_buffer, size_t count, l
 
 /* Write callback */
 static ssize_t driver_write(struct file *File, const char *user_buffer, size_t count, loff_t *offs) {
-	int to_copy, not_copied, delta;
+	size_t to_copy, not_copied, delta;
+
+	/* Exclusive lock, held for the copy only. */
+	if (down_write_killable(&my_rwsem))
+		return -EINTR;
 
 	/* Amount of data to copy */
 	to_copy = min(count, sizeof(buffer));
@@ -54,6 +63,7 @@ static ssize_t driver_write(struct file *File, const char *user_buffer, size_t c
 	/* Copy data to user, returns the amount of byte that weren't copied. */
 	not_copied = copy_from_user(buffer, user_buffer, to_copy);
 	buffer_pointer = to_copy - not_copied;
+	up_write(&my_rwsem);
 
 	/* Calculate delta */
 	delta = to_copy - not_copied;
@@ -61,24 +71,16 @@ static ssize_t driver_write(struct file *File, const char *user_buffer, size_t c
 	return delta;
 }
 
-/* Open callback. */
+/* Open callback. Locking is done per read/write, so any number of
+ * processes can keep the device open at the same time. */
 static int driver_open(struct inode *device_file, struct file *instance){
 	printk("read-write module - open was called!\n");
-	/*if(!mutex_trylock(&my_dyn_mutex)) {
-		printk("read-write module: resource busy, aborting!\n");
-		return -EBUSY;
-	}
 
-	return 0;*/
-
-	return mutex_lock_interruptible(&my_dyn_mutex);
-	/*mutex_lock(&my_dyn_mutex);*/
 	return 0;
 }
 
 static int driver_close(struct inode *device_file, struct file *instance){
 	printk("read-write module - close was called!\n");
-	mutex_unlock(&my_dyn_mutex);
 
 	return 0;
 }
@@ -114,6 +116,9 @@ static int __init ModuleInit(void) {
 		goto FileError;
 	}
 
+	/* Must be ready before cdev_add() makes the device reachable */
+	init_rwsem(&my_rwsem);
+
 	/* Init device file */
 	cdev_init(&my_device, &fops);
 
@@ -123,8 +128,6 @@ static int __init ModuleInit(void) {
 		goto AddError;
 	}
 
-	mutex_init(&my_dyn_mutex);
-
 	return 0;
 
 AddError:
@@ -139,7 +142,6 @@ ClassError:
 }
 
 static void __exit ModuleExit(void) {
-	mutex_destroy(&my_dyn_mutex);
 	cdev_del(&my_device);
 	device_destroy(my_class, my_device_number);
 	class_destroy(my_class);
@@ -7,55 +7,310 @@
 #include <asm/current.h>
 /* 'current' has a pointer to 'struct task_struct'*/
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/xarray.h>
+#include <linux/mm.h>
 
 #define DRIVER_NAME "dummydriver"
 #define DRIVER_CLASS "MyModuleClass"
+#define BUFFER_SIZE 255
+
+/* ioctl to fetch the version of the current snapshot */
+#define RW_IOCTL_MAGIC 'd'
+#define RW_IOCTL_GET_VERSION _IOR(RW_IOCTL_MAGIC, 0, __u64)
 
 /* Meta information */
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("DLH");
 MODULE_DESCRIPTION("Read an write on a device.");
 
-/* Buffer for data */
-static char buffer[255];
-static size_t buffer_pointer;
+/* Sparse store: one page per index, allocated on first write. */
+static unsigned long store_size_mb = 16;
+module_param(store_size_mb, ulong, 0444);
+MODULE_PARM_DESC(store_size_mb, "Capacity of the store in MiB, 1 to 1048576 (default: 16)");
+
+static loff_t store_size;
+static DEFINE_XARRAY(store_pages);
+
+/* First page of the mmap layout, read-only for userspace. The store itself
+ * is mapped from offset PAGE_SIZE on. seq is odd while a write() copies into
+ * the store, a reader retries if it was odd or changed across its access. */
+struct rw_mmap_header {
+	__u32 seq;
+	__u32 page_size;
+	__u64 store_size;
+};
+
+static struct page *header_page;
+static struct rw_mmap_header *header;
+/* Serialises write() on the store so seq stays a valid sequence count */
+static DEFINE_MUTEX(store_write_lock);
+/* Orders filling a hole against mapping the zero page in it, so that no
+ * zero page is left mapped over a store page */
+static DEFINE_MUTEX(store_map_lock);
+
+/* Snapshot mode: every write publishes a new immutable buffer, readers never
+ * lock and always see one whole write. */
+static bool snapshot_mode;
+module_param(snapshot_mode, bool, 0444);
+MODULE_PARM_DESC(snapshot_mode, "Publish each write as an RCU snapshot (default: 0)");
+
+struct rw_snapshot {
+	struct rcu_head rcu;
+	u64 version;
+	size_t len;
+	char data[];
+};
+
+static struct rw_snapshot __rcu *snapshot;
+/* Serialises writers only, readers use RCU */
+static DEFINE_MUTEX(snapshot_lock);
 
 /* Vars for device and device class */
 static dev_t my_device_number;
 static struct class *my_class;
 static struct cdev my_device;
 
-/* Read callback */
-static ssize_t driver_read(struct file *File, char *user_buffer, size_t count, loff_t *offs) {
-	size_t to_copy, not_copied, delta;
+/* Returns the backing page at index, allocating a zeroed one if there is
+ * none yet. Concurrent writers racing on a hole keep the first page stored.
+ * Mappings of the hole show the shared zero page, they are zapped so that
+ * the next access faults the new page in. */
+static struct page *store_page(struct address_space *mapping, pgoff_t index) {
+	struct page *page, *old;
+
+	page = xa_load(&store_pages, index);
+	if (page)
+		return page;
+
+	page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!page)
+		return NULL;
+
+	mutex_lock(&store_map_lock);
+	old = xa_cmpxchg(&store_pages, index, NULL, page, GFP_KERNEL);
+	if (!old)
+		/* Page 0 of the mapping is the header */
+		unmap_mapping_pages(mapping, index + 1, 1, false);
+	mutex_unlock(&store_map_lock);
+
+	if (old) {
+		__free_page(page);
+		return xa_is_err(old) ? NULL : old;
+	}
 
-	/* Amount of data to copy */
-	to_copy = min(count, buffer_pointer);
+	return page;
+}
 
-	/* Copy data to user, returns the amount of byte that weren't copied. */
-	not_copied = copy_to_user(user_buffer, buffer, to_copy);
+/* Read callback in snapshot mode. copy_to_user() may fault and sleep, so
+ * the snapshot is first copied into a bounce buffer under rcu_read_lock(). */
+static ssize_t snapshot_read(struct file *File, char *user_buffer, size_t count, loff_t *offs) {
+	char bounce[BUFFER_SIZE];
+	struct rw_snapshot *snap;
+	size_t to_copy = 0;
+
+	rcu_read_lock();
+	snap = rcu_dereference(snapshot);
+	if (snap && *offs < snap->len) {
+		to_copy = min(count, snap->len - (size_t)*offs);
+		memcpy(bounce, snap->data + *offs, to_copy);
+	}
+	rcu_read_unlock();
 
-	/* Calculate delta */
-	delta = to_copy - not_copied;
+	if (copy_to_user(user_buffer, bounce, to_copy))
+		return -EFAULT;
 
-	return delta;
+	*offs += to_copy;
+	return to_copy;
 }
 
-/* Write callback */
+/* Write callback in snapshot mode: build a new snapshot, publish it, and
+ * free the old one once all readers are done with it. */
+static ssize_t snapshot_write(struct file *File, const char *user_buffer, size_t count, loff_t *offs) {
+	struct rw_snapshot *snap, *old;
+	size_t to_copy;
+
+	to_copy = min(count, (size_t)BUFFER_SIZE);
+
+	snap = kmalloc(struct_size(snap, data, to_copy), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	if (copy_from_user(snap->data, user_buffer, to_copy)) {
+		kfree(snap);
+		return -EFAULT;
+	}
+	snap->len = to_copy;
+
+	mutex_lock(&snapshot_lock);
+	old = rcu_dereference_protected(snapshot, lockdep_is_held(&snapshot_lock));
+	snap->version = old ? old->version + 1 : 1;
+	rcu_assign_pointer(snapshot, snap);
+	mutex_unlock(&snapshot_lock);
+
+	if (old)
+		kfree_rcu(old, rcu);
+
+	return to_copy;
+}
+
+/* Read callback. Pages never written are holes and read back as zeros. */
+static ssize_t driver_read(struct file *File, char *user_buffer, size_t count, loff_t *offs) {
+	size_t done = 0;
+
+	if (snapshot_mode)
+		return snapshot_read(File, user_buffer, count, offs);
+
+	if (*offs >= store_size)
+		return 0;
+	count = min_t(size_t, count, store_size - *offs);
+
+	while (done < count) {
+		loff_t pos = *offs + done;
+		size_t page_off = offset_in_page(pos);
+		size_t to_copy = min_t(size_t, count - done, PAGE_SIZE - page_off);
+		struct page *page = xa_load(&store_pages, pos >> PAGE_SHIFT);
+		size_t not_copied;
+
+		if (page)
+			not_copied = copy_to_user(user_buffer + done, page_address(page) + page_off, to_copy);
+		else
+			not_copied = clear_user(user_buffer + done, to_copy);
+
+		done += to_copy - not_copied;
+		if (not_copied)
+			break;
+	}
+
+	if (!done && count)
+		return -EFAULT;
+
+	*offs += done;
+	return done;
+}
+
+/* Write callback. Backing pages are allocated on first write only. */
 static ssize_t driver_write(struct file *File, const char *user_buffer, size_t count, loff_t *offs) {
-	size_t to_copy, not_copied, delta;
+	size_t done = 0;
+	ssize_t err = -EFAULT;
+
+	if (snapshot_mode)
+		return snapshot_write(File, user_buffer, count, offs);
+
+	if (*offs >= store_size)
+		return count ? -ENOSPC : 0;
+	count = min_t(size_t, count, store_size - *offs);
+
+	if (mutex_lock_interruptible(&store_write_lock))
+		return -EINTR;
+	WRITE_ONCE(header->seq, header->seq + 1);
+	smp_wmb();
+
+	while (done < count) {
+		loff_t pos = *offs + done;
+		size_t page_off = offset_in_page(pos);
+		size_t to_copy = min_t(size_t, count - done, PAGE_SIZE - page_off);
+		struct page *page = store_page(File->f_mapping, pos >> PAGE_SHIFT);
+		size_t not_copied;
+
+		if (!page) {
+			err = -ENOMEM;
+			break;
+		}
+
+		not_copied = copy_from_user(page_address(page) + page_off, user_buffer + done, to_copy);
+
+		done += to_copy - not_copied;
+		if (not_copied)
+			break;
+	}
+
+	smp_wmb();
+	WRITE_ONCE(header->seq, header->seq + 1);
+	mutex_unlock(&store_write_lock);
+
+	if (!done && count)
+		return err;
+
+	*offs += done;
+	return done;
+}
 
-	/* Amount of data to copy */
-	to_copy = min(count, sizeof(buffer));
+/* Seek callback, the device behaves like a file of fixed size. */
+static loff_t driver_llseek(struct file *File, loff_t offset, int whence) {
+	return fixed_size_llseek(File, offset, whence, snapshot_mode ? BUFFER_SIZE : store_size);
+}
+
+/* Page fault in a mapping: page 0 is the header, the store follows. Like
+ * read(), reading a hole does not allocate: the zero page is mapped
+ * read-only instead, and replaced on the first write to it. */
+static vm_fault_t driver_vm_fault(struct vm_fault *vmf) {
+	struct page *page;
+	vm_fault_t ret;
+
+	if (vmf->pgoff == 0) {
+		page = header_page;
+	} else if (vmf->flags & FAULT_FLAG_WRITE) {
+		page = store_page(vmf->vma->vm_file->f_mapping, vmf->pgoff - 1);
+	} else {
+		mutex_lock(&store_map_lock);
+		page = xa_load(&store_pages, vmf->pgoff - 1);
+		if (!page) {
+			ret = vmf_insert_pfn(vmf->vma, vmf->address, my_zero_pfn(vmf->address));
+			mutex_unlock(&store_map_lock);
+			return ret;
+		}
+		mutex_unlock(&store_map_lock);
+	}
+
+	if (!page)
+		return VM_FAULT_OOM;
 
-	/* Copy data to user, returns the amount of byte that weren't copied. */
-	not_copied = copy_from_user(buffer, user_buffer, to_copy);
-	buffer_pointer = to_copy;
+	/* Store pages are only freed at module exit, after every mapping is gone */
+	return vmf_insert_pfn(vmf->vma, vmf->address, page_to_pfn(page));
+}
+
+/* First write to a page mapped read-only. Store pages just become writable,
+ * the zero page is dropped by allocating the store page, which zaps it in
+ * every mapping, and the write faults again on the new page. */
+static vm_fault_t driver_vm_pfn_mkwrite(struct vm_fault *vmf) {
+	if (!is_zero_pfn(pte_pfn(vmf->orig_pte)))
+		return 0;
 
-	/* Calculate delta */
-	delta = to_copy - not_copied;
+	if (!store_page(vmf->vma->vm_file->f_mapping, vmf->pgoff - 1))
+		return VM_FAULT_OOM;
 
-	return delta;
+	return VM_FAULT_NOPAGE;
+}
+
+static const struct vm_operations_struct driver_vm_ops = {
+	.fault = driver_vm_fault,
+	.pfn_mkwrite = driver_vm_pfn_mkwrite,
+};
+
+/* mmap callback, only for the store */
+static int driver_mmap(struct file *File, struct vm_area_struct *vma) {
+	unsigned long pages = vma_pages(vma);
+	unsigned long max_pages = 1 + (store_size >> PAGE_SHIFT);
+
+	if (snapshot_mode)
+		return -ENODEV;
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	if (vma->vm_pgoff >= max_pages || pages > max_pages - vma->vm_pgoff)
+		return -EINVAL;
+
+	/* The header is only updated by the driver */
+	if (vma->vm_pgoff == 0) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vm_flags_clear(vma, VM_MAYWRITE);
+	}
+
+	vm_flags_set(vma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP);
+	vma->vm_ops = &driver_vm_ops;
+	return 0;
 }
 
 /* Open callback. */
@@ -71,18 +326,50 @@ static int driver_close(struct inode *device_file, struct file *instance){
 	return 0;
 }
 
+/* ioctl callback. The version lets a reader skip the read when nothing
+ * changed since its last one; 0 means nothing was written yet. */
+static long driver_ioctl(struct file *File, unsigned int cmd, unsigned long arg) {
+	struct rw_snapshot *snap;
+	u64 version = 0;
+
+	if (cmd != RW_IOCTL_GET_VERSION)
+		return -ENOTTY;
+	if (!snapshot_mode)
+		return -EINVAL;
+
+	rcu_read_lock();
+	snap = rcu_dereference(snapshot);
+	if (snap)
+		version = snap->version;
+	rcu_read_unlock();
+
+	if (copy_to_user((u64 __user *)arg, &version, sizeof(version)))
+		return -EFAULT;
+
+	return 0;
+}
+
 static struct file_operations fops = {
 	.owner = THIS_MODULE,
+	.llseek = driver_llseek,
 	.open = driver_open,
 	.release = driver_close,
 	.read = driver_read,
-	.write = driver_write
+	.write = driver_write,
+	.mmap = driver_mmap,
+	.unlocked_ioctl = driver_ioctl
 };
 
 static int __init ModuleInit(void) {
 	/* printk writes to dmesg */
 	printk("Hi, I'm a new LKM!\n");
 
+	if (store_size_mb < 1 || store_size_mb > 1048576) {
+		printk("store_size_mb out of range\n");
+		return -EINVAL;
+	}
+	store_size = (loff_t)store_size_mb << 20;
+
 	/* Allocate device number */
 	if( alloc_chrdev_region(&my_device_number, 0, 1, DRIVER_NAME) < 0) {
 		printk("Device number could not be allocated\n");
@@ -102,19 +389,29 @@ static int __init ModuleInit(void) {
 		goto FileError;
 	}
 
+	header_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!header_page) {
+		printk("Can't allocate mmap header\n");
+		goto AddError;
+	}
+	header = page_address(header_page);
+	header->page_size = PAGE_SIZE;
+	header->store_size = store_size;
+
 	/* Init device file */
 	cdev_init(&my_device, &fops);
 
 	/* Registering device to kernel */
 	if (cdev_add(&my_device, my_device_number, 1) == -1) {
 		printk("Can't register device to kernel\n");
-		goto AddError;
+		goto HeaderError;
 	}
 
-	buffer_pointer = 0;
-
 	return 0;
 
+HeaderError:
+	__free_page(header_page);
+
 AddError:
 	device_destroy(my_class, my_device_number);
 
@@ -127,7 +424,16 @@ ClassError:
 }
 
 static void __exit ModuleExit(void) {
+	struct page *page;
+	unsigned long index;
+
 	cdev_del(&my_device);
+	xa_for_each(&store_pages, index, page)
+		__free_page(page);
+	xa_destroy(&store_pages);
+	__free_page(header_page);
+	/* Older snapshots are already queued on kfree_rcu() */
+	kfree(rcu_dereference_protected(snapshot, 1));
 	device_destroy(my_class, my_device_number);
 	class_destroy(my_class);
 	unregister_chrdev(my_device_number, DRIVER_NAME);
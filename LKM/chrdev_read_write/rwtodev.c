@@ -30,7 +30,8 @@ int main(int argc, char* argv[])
     getchar();
 
     printf("Reading from the device...\n");
-    ret = read(fd, receive, BUFFER_LENGTH);
+    /* The device keeps a file offset, read back from where the write started */
+    ret = pread(fd, receive, BUFFER_LENGTH - 1, 0);
     if (ret < 0){
         perror("Failed to read the message from the device.");
         return errno;
@@ -7,6 +7,29 @@
 #include <linux/mm.h>
 #include <linux/ktime.h>
 #include <linux/moduleparam.h>
+#include <linux/gfp.h>
+#include <linux/page_frag_cache.h>
+#include <linux/mempool.h>
+#include <linux/debugfs.h>
+#include <linux/seq_buf.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/sched/signal.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/mmzone.h>
+#include <linux/vmstat.h>
+#include <linux/delay.h>
+#include <linux/mman.h>
+#include <linux/random.h>
+#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
 
 #define MAX_ORDER_PRINT 11  // typically enough (0..10)
 
@@ -32,6 +55,27 @@ module_param(frag_order, int, 0644);
 MODULE_PARM_DESC(frag_order,
     "Order of allocated blocks for fragmentation (block size = 2^order * PAGE_SIZE)");
 
+/*
+ * Fragmentation pattern: "halves", "random" or "stride" (see
+ * fragment_memory()). With frag_movable, pinned pages are taken from
+ * movable pageblocks, polluting them instead of unmovable ones.
+ */
+static char frag_mode[16] = "halves";
+module_param_string(frag_mode, frag_mode, sizeof(frag_mode), 0644);
+MODULE_PARM_DESC(frag_mode, "Fragmentation pattern: halves, random or stride");
+
+static bool frag_movable;
+module_param(frag_movable, bool, 0644);
+MODULE_PARM_DESC(frag_movable, "Pin pages with movable GFP flags");
+
+/*
+ * Stop fragmenting once free memory drops to this percentage of RAM,
+ * instead of after frag_blocks blocks. 0 disables it.
+ */
+static int frag_target_free;
+module_param(frag_target_free, int, 0644);
+MODULE_PARM_DESC(frag_target_free, "Free memory to fragment down to, in percent (0: use frag_blocks)");
+
 /*
  * Order of the test allocation attempted with kmalloc()/vmalloc().
  * The requested size is: (2^test_order * PAGE_SIZE).
@@ -50,9 +94,131 @@ module_param(repeat, int, 0644);
 MODULE_PARM_DESC(repeat,
     "Number of times to repeat kmalloc/vmalloc timing test");
 
+/*
+ * Run the fragmentation demo at load time. Disable it to use the
+ * benchmarks in debugfs on an unfragmented system.
+ */
+static bool demo = true;
+module_param(demo, bool, 0444);
+MODULE_PARM_DESC(demo,
+    "Fragment memory and run the kmalloc/vmalloc test at load (default: 1)");
+
+/*
+ * Size sweep of the allocator benchmark, in bytes. Every power of two
+ * between the two bounds is measured.
+ */
+static unsigned long bench_min_size = 8;
+module_param(bench_min_size, ulong, 0644);
+MODULE_PARM_DESC(bench_min_size, "Smallest allocation size of the benchmark (bytes)");
+
+static unsigned long bench_max_size = 64UL << 20;
+module_param(bench_max_size, ulong, 0644);
+MODULE_PARM_DESC(bench_max_size, "Largest allocation size of the benchmark (bytes)");
+
+/*
+ * Iterations per (allocator, size) cell. Large sizes are capped to
+ * bench_max_bytes allocated in total so a sweep ends in reasonable time.
+ */
+static int bench_iters = 1000;
+module_param(bench_iters, int, 0644);
+MODULE_PARM_DESC(bench_iters, "Allocations measured per allocator and size");
+
+static unsigned long bench_max_bytes = 1UL << 30;
+module_param(bench_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(bench_max_bytes,
+    "Upper bound of bytes allocated per allocator and size (at least 16 iterations)");
+
+/*
+ * Multi-CPU scalability benchmark: one kthread per CPU of scale_cpus (a
+ * cpulist such as "0-3,8", empty for all online CPUs), each allocating and
+ * freeing scale_size bytes for scale_ms milliseconds. With scale_cross,
+ * every object is freed by the thread of the next CPU instead.
+ */
+static char scale_cpus[64];
+module_param_string(scale_cpus, scale_cpus, sizeof(scale_cpus), 0644);
+MODULE_PARM_DESC(scale_cpus, "CPUs used by scale_bench, as a cpulist (default: all online)");
+
+static unsigned long scale_size = 256;
+module_param(scale_size, ulong, 0644);
+MODULE_PARM_DESC(scale_size, "Allocation size of scale_bench (bytes)");
+
+static int scale_ms = 1000;
+module_param(scale_ms, int, 0644);
+MODULE_PARM_DESC(scale_ms, "Duration of each scale_bench step (ms)");
+
+static bool scale_cross;
+module_param(scale_cross, bool, 0644);
+MODULE_PARM_DESC(scale_cross, "Free each object on the next CPU instead of the allocating one");
+
+/*
+ * Fragmentation monitor: buddy free lists sampled every mon_period_ms
+ * into a ring of the last mon_samples samples (size applied at start).
+ */
+static int mon_period_ms = 1000;
+module_param(mon_period_ms, int, 0644);
+MODULE_PARM_DESC(mon_period_ms, "Sampling period of frag_monitor (ms)");
+
+static int mon_samples = 60;
+module_param(mon_samples, int, 0644);
+MODULE_PARM_DESC(mon_samples, "Number of samples kept by frag_monitor");
+
+/*
+ * Compaction recovery experiment: how long after compaction is triggered
+ * a test_order allocation succeeds again, waiting at most cmp_timeout_ms.
+ */
+static int cmp_timeout_ms = 10000;
+module_param(cmp_timeout_ms, int, 0644);
+MODULE_PARM_DESC(cmp_timeout_ms, "Longest wait for a test_order block after compaction (ms)");
+
+/*
+ * Access cost benchmark: buffers of access_size bytes from the linear map,
+ * vmalloc and huge vmalloc, walked access_passes times. copy_to_user() and
+ * copy_from_user() are done access_chunk bytes at a time, like read().
+ */
+static unsigned long access_size = 4UL << 20;
+module_param(access_size, ulong, 0644);
+MODULE_PARM_DESC(access_size, "Size of each access_bench buffer (bytes)");
+
+static int access_passes = 8;
+module_param(access_passes, int, 0644);
+MODULE_PARM_DESC(access_passes, "Passes over the buffer per access_bench measure");
+
+static unsigned long access_chunk = 64UL << 10;
+module_param(access_chunk, ulong, 0644);
+MODULE_PARM_DESC(access_chunk, "Size of each copy_to_user/copy_from_user in access_bench (bytes)");
+
+/*
+ * GFP matrix: matrix_iters allocations per (context, flags, order) cell,
+ * for orders 0 to matrix_max_order.
+ */
+static int matrix_iters = 100;
+module_param(matrix_iters, int, 0644);
+MODULE_PARM_DESC(matrix_iters, "Allocations per gfp_matrix cell");
+
+static int matrix_max_order = 10;
+module_param(matrix_max_order, int, 0644);
+MODULE_PARM_DESC(matrix_max_order, "Highest order of gfp_matrix");
+
+/*
+ * Deferred free benchmark: rcu_objects objects of rcu_size bytes freed
+ * with kfree(), kfree_rcu(), one call_rcu() each, or one call_rcu() per
+ * rcu_batch objects.
+ */
+static int rcu_objects = 1000000;
+module_param(rcu_objects, int, 0644);
+MODULE_PARM_DESC(rcu_objects, "Objects allocated and freed per rcu_bench mode");
+
+static unsigned long rcu_size = 256;
+module_param(rcu_size, ulong, 0644);
+MODULE_PARM_DESC(rcu_size, "Object size of rcu_bench (bytes)");
+
+static int rcu_batch = 64;
+module_param(rcu_batch, int, 0644);
+MODULE_PARM_DESC(rcu_batch, "Objects per call_rcu() in the batched mode of rcu_bench");
+
 /* ---------- Globals ---------- */
 
-static void **blocks;
+static struct dentry *debugfs_dir;
 
 /* ---------- Buddy info helpers ---------- */
 
@@ -87,37 +253,223 @@ static void print_all_zones(const char *tag)
 
 /* ---------- Fragmentation ---------- */
 
-static int fragment_memory(void)
+/*
+ * Every pinned page is recorded, so teardown frees exactly what is still
+ * held. Blocks are split into order-0 pages right after allocation, which
+ * lets any part of them be freed on its own.
+ */
+struct frag_pin {
+    struct page *page;
+    unsigned long nr;   /* contiguous order-0 pages */
+};
+
+#define FRAG_CHUNK 510
+
+struct frag_chunk {
+    struct list_head list;
+    unsigned int nr;
+    struct frag_pin pins[FRAG_CHUNK];
+};
+
+enum frag_pattern {
+    FRAG_HALVES,
+    FRAG_RANDOM,
+    FRAG_STRIDE,
+};
+
+static const char * const frag_pattern_names[] = {
+    [FRAG_HALVES] = "halves",
+    [FRAG_RANDOM] = "random",
+    [FRAG_STRIDE] = "stride",
+};
+
+static LIST_HEAD(frag_chunks);
+static unsigned long frag_blocks_done;
+static unsigned long frag_pinned_pages;
+
+static bool frag_active(void)
 {
-    int i;
+    return !list_empty(&frag_chunks);
+}
 
-    blocks = kmalloc_array(frag_blocks, sizeof(void *), GFP_KERNEL);
-    if (!blocks)
-        return -ENOMEM;
+static void free_run(struct page *page, unsigned long nr)
+{
+    unsigned long i;
 
-    /* Step 1: allocate higher-order blocks */
-    for (i = 0; i < frag_blocks; i++) {
-        blocks[i] = (void *)__get_free_pages(GFP_KERNEL, frag_order);
-        if (!blocks[i])
-            break;
+    for (i = 0; i < nr; i++)
+        __free_page(page + i);
+}
+
+static int frag_pin(struct page *page, unsigned long nr)
+{
+    struct frag_chunk *c;
+
+    if (!nr)
+        return 0;
+
+    c = list_empty(&frag_chunks) ? NULL :
+        list_last_entry(&frag_chunks, struct frag_chunk, list);
+    if (!c || c->nr == FRAG_CHUNK) {
+        c = kmalloc(sizeof(*c), GFP_KERNEL);
+        if (!c)
+            return -ENOMEM;
+        c->nr = 0;
+        list_add_tail(&c->list, &frag_chunks);
     }
 
-    pr_info("Allocated %d/%d blocks of order %d\n", i, frag_blocks, frag_order);
+    c->pins[c->nr].page = page;
+    c->pins[c->nr].nr = nr;
+    c->nr++;
+    frag_pinned_pages += nr;
+    return 0;
+}
 
-    /* Step 2: partially free them → prevent coalescing */
-    for (int j = 0; j < i; j++) {
-        if (!blocks[j])
-            continue;
+static void frag_release(void)
+{
+    struct frag_chunk *c, *tmp;
+    unsigned int i;
+
+    list_for_each_entry_safe(c, tmp, &frag_chunks, list) {
+        for (i = 0; i < c->nr; i++)
+            free_run(c->pins[i].page, c->pins[i].nr);
+        list_del(&c->list);
+        kfree(c);
+    }
+
+    frag_blocks_done = 0;
+    frag_pinned_pages = 0;
+}
 
-        /* free half: split into buddies */
-        free_pages((unsigned long)blocks[j], frag_order - 1);
+static unsigned int free_percent(void)
+{
+    return global_zone_page_state(NR_FREE_PAGES) * 100 / totalram_pages();
+}
+
+/* Keeps pages [keep, keep + nr) of a split block of 2^order pages */
+static int frag_keep(struct page *page, int order, unsigned long keep,
+                     unsigned long nr)
+{
+    unsigned long total = 1UL << order;
 
-        /* keep half allocated → blocks merging */
+    free_run(page, keep);
+    free_run(page + keep + nr, total - keep - nr);
+
+    if (frag_pin(page + keep, nr)) {
+        free_run(page + keep, nr);
+        return -ENOMEM;
     }
 
     return 0;
 }
 
+static int frag_pattern_from(const char *name)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(frag_pattern_names); i++)
+        if (!strcmp(name, frag_pattern_names[i]))
+            return i;
+
+    return -EINVAL;
+}
+
+/*
+ * Allocates frag_blocks blocks, or until free memory drops to
+ * frag_target_free percent when set, and keeps part of each:
+ * - halves: blocks of frag_order, the upper half is kept;
+ * - random: blocks of random order up to frag_order, a random run is kept;
+ * - stride: pageblocks, one random page of each is kept.
+ * frag_movable places the kept pages in movable pageblocks.
+ */
+static int fragment_memory(void)
+{
+    gfp_t gfp = (frag_movable ? GFP_HIGHUSER_MOVABLE : GFP_KERNEL) |
+                __GFP_NOWARN | __GFP_NORETRY;
+    int pattern = frag_pattern_from(frag_mode);
+    unsigned long i, keep, nr, fails = 0;
+    struct page *page;
+    int order, ret = 0;
+
+    if (pattern < 0 || frag_order < 1 || frag_order > MAX_PAGE_ORDER)
+        return -EINVAL;
+
+    for (i = 0; frag_target_free > 0 ? free_percent() > frag_target_free : i < frag_blocks; i++) {
+        switch (pattern) {
+        case FRAG_RANDOM:
+            order = get_random_u32_below(frag_order + 1);
+            break;
+        case FRAG_STRIDE:
+            order = pageblock_order;
+            break;
+        default:
+            order = frag_order;
+            break;
+        }
+
+        page = alloc_pages(gfp, order);
+        if (!page) {
+            /* A random order may fit where the last one did not */
+            if (pattern == FRAG_RANDOM && ++fails < 64)
+                continue;
+            break;
+        }
+        fails = 0;
+        if (order)
+            split_page(page, order);
+
+        switch (pattern) {
+        case FRAG_RANDOM:
+            keep = get_random_u32_below(1U << order);
+            nr = 1 + get_random_u32_below((1U << order) - keep);
+            break;
+        case FRAG_STRIDE:
+            keep = get_random_u32_below(1U << order);
+            nr = 1;
+            break;
+        default:
+            keep = 1UL << (order - 1);
+            nr = keep;
+            break;
+        }
+
+        ret = frag_keep(page, order, keep, nr);
+        if (ret)
+            break;
+        frag_blocks_done++;
+
+        if (fatal_signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+        cond_resched();
+    }
+
+    pr_info("Fragmented with %s: %lu blocks, %lu pages pinned, %u%% memory free\n",
+            frag_pattern_names[pattern], frag_blocks_done, frag_pinned_pages,
+            free_percent());
+
+    return ret;
+}
+
+/* Writing "release" frees everything, anything else fragments further */
+static int run_fragment(struct seq_buf *s, const char *arg)
+{
+    int ret = 0;
+
+    if (!strcmp(arg, "release"))
+        frag_release();
+    else
+        ret = fragment_memory();
+
+    seq_buf_printf(s, "pattern %s, order %d, %s pages, target %d%% free\n",
+                   frag_mode, frag_order, frag_movable ? "movable" : "unmovable",
+                   frag_target_free);
+    seq_buf_printf(s, "%lu blocks, %lu pages pinned, %u%% memory free\n",
+                   frag_blocks_done, frag_pinned_pages, free_percent());
+
+    return ret;
+}
+
 /* ---------- Test ---------- */
 
 static void run_test(void)
@@ -157,40 +509,1811 @@ static void run_test(void)
     }
 }
 
-/* ---------- Init / Exit ---------- */
+/* ---------- Latency statistics ---------- */
 
-static int __init demo_init(void)
+struct lat_stats {
+    u64 min;
+    u64 median;
+    u64 p99;
+    u64 max;
+};
+
+static int cmp_u64(const void *a, const void *b)
 {
-    pr_info("=== kmalloc vs vmalloc + buddy histogram demo ===\n");
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
 
-    print_all_zones("BEFORE");
+    return x < y ? -1 : x > y;
+}
 
-    if (fragment_memory()) {
-        pr_err("Fragmentation failed\n");
-        return -ENOMEM;
+/* Sorts the samples in place */
+static void compute_stats(u64 *ns, unsigned int n, struct lat_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    if (!n)
+        return;
+
+    sort(ns, n, sizeof(*ns), cmp_u64, NULL);
+    st->min = ns[0];
+    st->median = ns[n / 2];
+    st->p99 = ns[(n * 99ULL) / 100];
+    st->max = ns[n - 1];
+}
+
+static void print_stats(struct seq_buf *s, const struct lat_stats *st)
+{
+    seq_buf_printf(s, " %8llu %8llu %8llu %10llu",
+                   st->min, st->median, st->p99, st->max);
+}
+
+/*
+ * Log2 histogram for runs too long to keep every sample. Percentiles are
+ * the upper bound of their bucket, min and max are exact.
+ */
+#define HIST_BUCKETS 40
+
+struct lat_hist {
+    u64 count;
+    u64 min;
+    u64 max;
+    u32 bucket[HIST_BUCKETS];
+};
+
+static void hist_add(struct lat_hist *h, u64 ns)
+{
+    unsigned int b = min_t(unsigned int, fls64(ns), HIST_BUCKETS - 1);
+
+    if (!h->count || ns < h->min)
+        h->min = ns;
+    if (ns > h->max)
+        h->max = ns;
+    h->bucket[b]++;
+    h->count++;
+}
+
+static u64 hist_percentile(const struct lat_hist *h, unsigned int pct)
+{
+    u64 target = div_u64(h->count * pct, 100), seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen > target)
+            return min(b ? (1ULL << b) - 1 : 0, h->max);
     }
 
-    print_all_zones("AFTER_FRAG");
+    return h->max;
+}
 
-    run_test();
+static void hist_stats(const struct lat_hist *h, struct lat_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    if (!h->count)
+        return;
 
-    print_all_zones("AFTER_TEST");
+    st->min = h->min;
+    st->median = hist_percentile(h, 50);
+    st->p99 = hist_percentile(h, 99);
+    st->max = h->max;
+}
+
+/* ---------- Allocators ---------- */
+
+/*
+ * One allocator under test. setup()/teardown() run once per size, outside
+ * the measured section, to create caches, pools and fragment caches.
+ */
+struct alloc_ctx {
+    size_t size;
+    gfp_t gfp;
+    unsigned int order;
+    struct kmem_cache *cache;
+    mempool_t *pool;
+    struct page_frag_cache frag;
+};
+
+struct alloc_ops {
+    const char *name;
+    bool (*supports)(size_t size);
+    int (*setup)(struct alloc_ctx *c);
+    void *(*alloc)(struct alloc_ctx *c);
+    void (*free)(struct alloc_ctx *c, void *p);
+    void (*teardown)(struct alloc_ctx *c);
+};
+
+static bool fits_kmalloc(size_t size)
+{
+    return size <= KMALLOC_MAX_SIZE;
+}
+
+static bool fits_page(size_t size)
+{
+    return size <= PAGE_SIZE;
+}
+
+static bool fits_buddy(size_t size)
+{
+    return get_order(size) <= MAX_PAGE_ORDER;
+}
+
+static bool fits_any(size_t size)
+{
+    return true;
+}
+
+static void *kmalloc_op(struct alloc_ctx *c)
+{
+    return kmalloc(c->size, c->gfp);
+}
+
+static void kfree_op(struct alloc_ctx *c, void *p)
+{
+    kfree(p);
+}
+
+static void *kvmalloc_op(struct alloc_ctx *c)
+{
+    return kvmalloc(c->size, c->gfp);
+}
+
+static void *vmalloc_op(struct alloc_ctx *c)
+{
+    return __vmalloc(c->size, c->gfp);
+}
+
+static void kvfree_op(struct alloc_ctx *c, void *p)
+{
+    kvfree(p);
+}
+
+static void vfree_op(struct alloc_ctx *c, void *p)
+{
+    vfree(p);
+}
 
+static int pages_setup(struct alloc_ctx *c)
+{
+    c->order = get_order(c->size);
     return 0;
 }
 
-static void __exit demo_exit(void)
+static void *pages_op(struct alloc_ctx *c)
 {
-    int i;
+    return alloc_pages(c->gfp, c->order);
+}
+
+static void free_pages_op(struct alloc_ctx *c, void *p)
+{
+    __free_pages(p, c->order);
+}
+
+static int cache_setup(struct alloc_ctx *c)
+{
+    c->cache = kmem_cache_create("kvv_bench", c->size, 0, 0, NULL);
+    return c->cache ? 0 : -ENOMEM;
+}
+
+static void *cache_op(struct alloc_ctx *c)
+{
+    return kmem_cache_alloc(c->cache, c->gfp);
+}
+
+static void cache_free_op(struct alloc_ctx *c, void *p)
+{
+    kmem_cache_free(c->cache, p);
+}
+
+static void cache_teardown(struct alloc_ctx *c)
+{
+    kmem_cache_destroy(c->cache);
+}
+
+/* A small reserve, the fast path still goes to kmalloc() */
+static int pool_setup(struct alloc_ctx *c)
+{
+    c->pool = mempool_create_kmalloc_pool(4, c->size);
+    return c->pool ? 0 : -ENOMEM;
+}
+
+static void *pool_op(struct alloc_ctx *c)
+{
+    return mempool_alloc(c->pool, c->gfp);
+}
+
+static void pool_free_op(struct alloc_ctx *c, void *p)
+{
+    mempool_free(p, c->pool);
+}
+
+static void pool_teardown(struct alloc_ctx *c)
+{
+    mempool_destroy(c->pool);
+}
+
+static int frag_setup(struct alloc_ctx *c)
+{
+    memset(&c->frag, 0, sizeof(c->frag));
+    return 0;
+}
+
+static void *frag_op(struct alloc_ctx *c)
+{
+    return page_frag_alloc(&c->frag, c->size, c->gfp);
+}
 
-    if (blocks) {
-        for (i = 0; i < frag_blocks; i++) {
-            if (blocks[i])
-                free_pages((unsigned long)blocks[i], frag_order);
+static void frag_free_op(struct alloc_ctx *c, void *p)
+{
+    page_frag_free(p);
+}
+
+static void frag_teardown(struct alloc_ctx *c)
+{
+    page_frag_cache_drain(&c->frag);
+}
+
+static const struct alloc_ops allocators[] = {
+    { "kmalloc",   fits_kmalloc, NULL,        kmalloc_op,  kfree_op,       NULL },
+    { "kvmalloc",  fits_any,     NULL,        kvmalloc_op, kvfree_op,      NULL },
+    { "vmalloc",   fits_any,     NULL,        vmalloc_op,  vfree_op,       NULL },
+    { "pages",     fits_buddy,   pages_setup, pages_op,    free_pages_op,  NULL },
+    { "kmem_cache", fits_kmalloc, cache_setup, cache_op,   cache_free_op,  cache_teardown },
+    { "mempool",   fits_kmalloc, pool_setup,  pool_op,     pool_free_op,   pool_teardown },
+    { "page_frag", fits_page,    frag_setup,  frag_op,     frag_free_op,   frag_teardown },
+};
+
+static const struct alloc_ops *find_allocator(const char *name)
+{
+    int a;
+
+    for (a = 0; a < ARRAY_SIZE(allocators); a++)
+        if (!strcmp(name, allocators[a].name))
+            return &allocators[a];
+
+    return NULL;
+}
+
+/* ---------- Allocator benchmark ---------- */
+
+static unsigned int iters_for(size_t size, unsigned int max_iters)
+{
+    unsigned long n = bench_max_bytes / size;
+
+    return clamp_t(unsigned long, n, 16, max_iters);
+}
+
+/*
+ * Allocates and frees one object per iteration, timing both separately.
+ * Returns the number of failed allocations.
+ */
+static unsigned int bench_cell(const struct alloc_ops *ops, struct alloc_ctx *c,
+                               u64 *alloc_ns, u64 *free_ns, unsigned int *n)
+{
+    unsigned int i, done = 0, fails = 0;
+    u64 t1, t2, t3;
+    void *p;
+
+    for (i = 0; i < *n; i++) {
+        t1 = ktime_get_ns();
+        p = ops->alloc(c);
+        t2 = ktime_get_ns();
+
+        if (!p) {
+            fails++;
+            continue;
         }
-        kfree(blocks);
+
+        ops->free(c, p);
+        t3 = ktime_get_ns();
+
+        alloc_ns[done] = t2 - t1;
+        free_ns[done] = t3 - t2;
+        done++;
+
+        cond_resched();
+        if (fatal_signal_pending(current))
+            break;
     }
 
+    *n = done;
+    return fails;
+}
+
+static int run_alloc_bench(struct seq_buf *s, const char *arg)
+{
+    /* Read once: the arrays must fit every cell even if it changes meanwhile */
+    unsigned int max_iters = max(READ_ONCE(bench_iters), 16);
+    u64 *alloc_ns, *free_ns;
+    struct lat_stats st;
+    size_t size;
+    int a, ret = 0;
+
+    alloc_ns = kvmalloc_array(max_iters, sizeof(u64), GFP_KERNEL);
+    free_ns = kvmalloc_array(max_iters, sizeof(u64), GFP_KERNEL);
+    if (!alloc_ns || !free_ns) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    seq_buf_printf(s, "%-10s %10s %6s %5s | %-38s | %-38s\n", "allocator",
+                   "size", "iters", "fails",
+                   "alloc ns: min median p99 max", "free ns: min median p99 max");
+
+    for (a = 0; a < ARRAY_SIZE(allocators); a++) {
+        const struct alloc_ops *ops = &allocators[a];
+
+        if (*arg && strcmp(arg, "all") && strcmp(arg, ops->name))
+            continue;
+
+        for (size = bench_min_size; size && size <= bench_max_size; size <<= 1) {
+            struct alloc_ctx c = { .size = size, .gfp = GFP_KERNEL | __GFP_NOWARN };
+            unsigned int n = iters_for(size, max_iters), fails;
+
+            if (!ops->supports(size))
+                continue;
+
+            if (ops->setup && ops->setup(&c)) {
+                seq_buf_printf(s, "%-10s %10zu setup failed\n", ops->name, size);
+                continue;
+            }
+
+            fails = bench_cell(ops, &c, alloc_ns, free_ns, &n);
+
+            if (ops->teardown)
+                ops->teardown(&c);
+
+            seq_buf_printf(s, "%-10s %10zu %6u %5u |", ops->name, size, n, fails);
+            compute_stats(alloc_ns, n, &st);
+            print_stats(s, &st);
+            seq_buf_printf(s, " |");
+            compute_stats(free_ns, n, &st);
+            print_stats(s, &st);
+            seq_buf_printf(s, "\n");
+
+            if (fatal_signal_pending(current)) {
+                ret = -EINTR;
+                goto out;
+            }
+        }
+    }
+
+out:
+    kvfree(alloc_ns);
+    kvfree(free_ns);
+    return ret;
+}
+
+/* ---------- Multi-CPU scalability benchmark ---------- */
+
+#define SCALE_RING 1024
+
+/*
+ * Objects handed over to a thread for freeing. Single producer (the thread
+ * of the previous CPU), single consumer (the owner).
+ */
+struct scale_ring {
+    unsigned int head;
+    unsigned int tail;
+    void *objs[SCALE_RING];
+};
+
+struct scale_run;
+
+struct scale_thread {
+    int cpu;
+    struct scale_run *run;
+    struct scale_thread *peer;
+    struct scale_ring ring;
+    u64 pairs;
+    u64 fails;
+    u64 ring_full;
+    struct lat_hist alloc_lat;
+    struct lat_hist free_lat;
+    struct completion done;
+};
+
+struct scale_run {
+    const struct alloc_ops *ops;
+    struct alloc_ctx ctx;
+    u64 deadline;
+    bool go;
+    wait_queue_head_t start_wq;
+};
+
+static bool ring_push(struct scale_ring *r, void *p)
+{
+    unsigned int head = r->head;
+
+    if (head - smp_load_acquire(&r->tail) == SCALE_RING)
+        return false;
+
+    r->objs[head % SCALE_RING] = p;
+    smp_store_release(&r->head, head + 1);
+    return true;
+}
+
+static void *ring_pop(struct scale_ring *r)
+{
+    unsigned int tail = r->tail;
+    void *p;
+
+    if (tail == smp_load_acquire(&r->head))
+        return NULL;
+
+    p = r->objs[tail % SCALE_RING];
+    smp_store_release(&r->tail, tail + 1);
+    return p;
+}
+
+static void scale_free(struct scale_run *run, struct scale_thread *t, void *p)
+{
+    u64 t1 = ktime_get_ns();
+
+    run->ops->free(&run->ctx, p);
+    hist_add(&t->free_lat, ktime_get_ns() - t1);
+}
+
+static int scale_thread_fn(void *data)
+{
+    struct scale_thread *t = data;
+    struct scale_run *run = t->run;
+    u64 t1, t2;
+    void *p;
+
+    /* Pairs with the release in scale_step(), peer is set by then */
+    wait_event(run->start_wq, smp_load_acquire(&run->go));
+
+    while ((t1 = ktime_get_ns()) < run->deadline) {
+        p = run->ops->alloc(&run->ctx);
+        t2 = ktime_get_ns();
+
+        if (!p) {
+            t->fails++;
+        } else {
+            hist_add(&t->alloc_lat, t2 - t1);
+
+            if (!scale_cross)
+                scale_free(run, t, p);
+            else if (!ring_push(&t->peer->ring, p)) {
+                t->ring_full++;
+                scale_free(run, t, p);
+            }
+            t->pairs++;
+        }
+
+        while (scale_cross && (p = ring_pop(&t->ring)))
+            scale_free(run, t, p);
+
+        cond_resched();
+    }
+
+    kthread_complete_and_exit(&t->done, 0);
+}
+
+/* Runs one step on the first n CPUs of the mask */
+static int scale_step(struct seq_buf *s, struct scale_run *run,
+                      const struct cpumask *mask, int n)
+{
+    struct scale_thread *threads;
+    u64 pairs = 0, fails = 0, ring_full = 0;
+    struct lat_stats st;
+    int i, cpu, started = 0;
+    void *p;
+
+    threads = kvcalloc(n, sizeof(*threads), GFP_KERNEL);
+    if (!threads)
+        return -ENOMEM;
+
+    run->go = false;
+    init_waitqueue_head(&run->start_wq);
+
+    i = 0;
+    for_each_cpu(cpu, mask) {
+        struct task_struct *task;
+
+        if (i == n)
+            break;
+
+        threads[i].cpu = cpu;
+        threads[i].run = run;
+        init_completion(&threads[i].done);
+
+        task = kthread_create(scale_thread_fn, &threads[i], "kvv_scale/%d", cpu);
+        if (IS_ERR(task))
+            break;
+        kthread_bind(task, cpu);
+        wake_up_process(task);
+        started = ++i;
+    }
+
+    /* Peers among the threads that really started, so that no object is
+     * pushed to a ring nobody drains */
+    for (i = 0; i < started; i++)
+        threads[i].peer = &threads[(i + 1) % started];
+
+    /* Same deadline for everyone, released together */
+    run->deadline = ktime_get_ns() + (u64)scale_ms * NSEC_PER_MSEC;
+    smp_store_release(&run->go, true);
+    wake_up_all(&run->start_wq);
+
+    for (i = 0; i < started; i++)
+        wait_for_completion(&threads[i].done);
+
+    /* Objects still in flight between CPUs */
+    for (i = 0; i < started; i++)
+        while ((p = ring_pop(&threads[i].ring)))
+            run->ops->free(&run->ctx, p);
+
+    for (i = 0; i < started; i++) {
+        pairs += threads[i].pairs;
+        fails += threads[i].fails;
+        ring_full += threads[i].ring_full;
+    }
+
+    seq_buf_printf(s, "cpus %d: %llu ops/s, %llu fails, %llu frees kept local (ring full)\n",
+                   started, div_u64(pairs * 1000, max(scale_ms, 1)), fails, ring_full);
+
+    for (i = 0; i < started; i++) {
+        seq_buf_printf(s, "  cpu %3d %10llu ops |", threads[i].cpu, threads[i].pairs);
+        hist_stats(&threads[i].alloc_lat, &st);
+        print_stats(s, &st);
+        seq_buf_printf(s, " |");
+        hist_stats(&threads[i].free_lat, &st);
+        print_stats(s, &st);
+        seq_buf_printf(s, "\n");
+    }
+
+    kvfree(threads);
+    return started == n ? 0 : -EAGAIN;
+}
+
+static int run_scale_bench(struct seq_buf *s, const char *arg)
+{
+    struct scale_run *run;
+    cpumask_var_t mask;
+    int n, nr, ret = 0;
+
+    run = kzalloc(sizeof(*run), GFP_KERNEL);
+    if (!run)
+        return -ENOMEM;
+
+    run->ops = find_allocator(*arg ? arg : "kmalloc");
+    /* A page_frag_cache is not safe to share between CPUs */
+    if (!run->ops || run->ops->alloc == frag_op || !run->ops->supports(scale_size)) {
+        kfree(run);
+        return -EINVAL;
+    }
+
+    if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+        kfree(run);
+        return -ENOMEM;
+    }
+
+    if (!*scale_cpus)
+        cpumask_copy(mask, cpu_online_mask);
+    else if (cpulist_parse(scale_cpus, mask))
+        ret = -EINVAL;
+    cpumask_and(mask, mask, cpu_online_mask);
+    nr = cpumask_weight(mask);
+    if (!ret && !nr)
+        ret = -EINVAL;
+
+    run->ctx.size = scale_size;
+    run->ctx.gfp = GFP_KERNEL | __GFP_NOWARN;
+    if (!ret && run->ops->setup)
+        ret = run->ops->setup(&run->ctx);
+    if (ret)
+        goto out;
+
+    seq_buf_printf(s, "%s, %lu bytes, %s free, %d ms per step\n",
+                   run->ops->name, scale_size, scale_cross ? "cross-CPU" : "local", scale_ms);
+    seq_buf_printf(s, "  %-18s | %-38s | %-38s\n", "",
+                   "alloc ns: min median p99 max", "free ns: min median p99 max");
+
+    /* 1, 2, 4, ... CPUs, and all of them last */
+    for (n = 1; ; n = min(n * 2, nr)) {
+        ret = scale_step(s, run, mask, n);
+        if (ret || n == nr || fatal_signal_pending(current))
+            break;
+    }
+
+    if (run->ops->teardown)
+        run->ops->teardown(&run->ctx);
+out:
+    free_cpumask_var(mask);
+    kfree(run);
+    return ret;
+}
+
+/* ---------- Fragmentation monitor ---------- */
+
+/* Same cap as /proc/pagetypeinfo, long free lists are walked with IRQs off */
+#define MON_LIST_CAP 100000
+
+struct mon_zone {
+    int nid;
+    const char *name;
+    unsigned long nr_free[NR_PAGE_ORDERS][MIGRATE_TYPES];
+};
+
+struct mon_sample {
+    u64 time_ns;
+    struct mon_zone zones[];
+};
+
+static DEFINE_MUTEX(mon_lock);
+static struct delayed_work mon_work;
+static bool mon_running;
+static void *mon_ring;
+static size_t mon_sample_size;
+static unsigned int mon_nr_zones;
+static unsigned int mon_capacity;
+static unsigned long mon_head;  /* samples taken since start */
+
+static const char *mt_name(int mt)
+{
+    switch (mt) {
+    case MIGRATE_UNMOVABLE:   return "unmov";
+    case MIGRATE_MOVABLE:     return "mov";
+    case MIGRATE_RECLAIMABLE: return "recl";
+    case MIGRATE_HIGHATOMIC:  return "hiatom";
+#ifdef CONFIG_CMA
+    case MIGRATE_CMA:         return "cma";
+#endif
+#ifdef CONFIG_MEMORY_ISOLATION
+    case MIGRATE_ISOLATE:     return "iso";
+#endif
+    default:                  return "?";
+    }
+}
+
+#define for_each_populated_node_zone(nid, zone)                         \
+    for_each_online_node(nid)                                           \
+        for (zone = NODE_DATA(nid)->node_zones;                         \
+             zone < NODE_DATA(nid)->node_zones + MAX_NR_ZONES; zone++)  \
+            if (populated_zone(zone))
+
+static struct mon_sample *mon_slot(unsigned long i)
+{
+    return mon_ring + (i % mon_capacity) * mon_sample_size;
+}
+
+static void mon_sample_zone(struct zone *zone, struct mon_zone *mz)
+{
+    unsigned long flags, n;
+    struct list_head *pos;
+    int order, mt;
+
+    for (order = 0; order < NR_PAGE_ORDERS; order++) {
+        spin_lock_irqsave(&zone->lock, flags);
+        for (mt = 0; mt < MIGRATE_TYPES; mt++) {
+            n = 0;
+            list_for_each(pos, &zone->free_area[order].free_list[mt])
+                if (++n >= MON_LIST_CAP)
+                    break;
+            mz->nr_free[order][mt] = n;
+        }
+        spin_unlock_irqrestore(&zone->lock, flags);
+        cond_resched();
+    }
+}
+
+static void mon_work_fn(struct work_struct *work)
+{
+    struct mon_sample *smp;
+    struct zone *zone;
+    unsigned int z = 0;
+    int nid;
+
+    mutex_lock(&mon_lock);
+
+    smp = mon_slot(mon_head);
+    smp->time_ns = ktime_get_boottime_ns();
+    for_each_populated_node_zone(nid, zone) {
+        if (z == mon_nr_zones)
+            break;
+        smp->zones[z].nid = nid;
+        smp->zones[z].name = zone->name;
+        mon_sample_zone(zone, &smp->zones[z]);
+        z++;
+    }
+    mon_head++;
+
+    if (mon_running)
+        schedule_delayed_work(&mon_work, msecs_to_jiffies(max(mon_period_ms, 1)));
+
+    mutex_unlock(&mon_lock);
+}
+
+/*
+ * Indices of mm/vmstat.c (/sys/kernel/debug/extfrag), scaled by 1000.
+ * unusable: share of free memory in blocks too small for the order.
+ * fragmentation: towards 0 a failure would be due to lack of memory,
+ * towards 1000 due to fragmentation, -1000 when the order is available.
+ */
+static void mon_indices(const struct mon_zone *mz, int order,
+                        int *unusable, int *fragidx)
+{
+    unsigned long free_pages = 0, blocks_total = 0, blocks_suitable = 0;
+    unsigned long nr;
+    int o, mt;
+
+    for (o = 0; o < NR_PAGE_ORDERS; o++) {
+        nr = 0;
+        for (mt = 0; mt < MIGRATE_TYPES; mt++)
+            nr += mz->nr_free[o][mt];
+
+        blocks_total += nr;
+        free_pages += nr << o;
+        if (o >= order)
+            blocks_suitable += nr << (o - order);
+    }
+
+    if (!free_pages)
+        *unusable = 1000;
+    else
+        *unusable = div_u64((u64)(free_pages - (blocks_suitable << order)) * 1000,
+                            free_pages);
+
+    if (blocks_suitable)
+        *fragidx = -1000;
+    else if (!blocks_total)
+        *fragidx = 0;
+    else
+        *fragidx = 1000 - div_u64(1000 + div_u64((u64)free_pages * 1000, 1UL << order),
+                                  blocks_total);
+}
+
+/* Position 0 is the header, then the samples from oldest to newest */
+static void *mon_seq_get(loff_t pos)
+{
+    unsigned long first, idx;
+
+    if (!pos)
+        return SEQ_START_TOKEN;
+    if (!mon_ring)
+        return NULL;
+
+    first = mon_head > mon_capacity ? mon_head - mon_capacity : 0;
+    idx = first + pos - 1;
+
+    return idx < mon_head ? mon_slot(idx) : NULL;
+}
+
+static void *mon_seq_start(struct seq_file *m, loff_t *pos)
+{
+    mutex_lock(&mon_lock);
+    return mon_seq_get(*pos);
+}
+
+static void *mon_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    ++*pos;
+    return mon_seq_get(*pos);
+}
+
+static void mon_seq_stop(struct seq_file *m, void *v)
+{
+    mutex_unlock(&mon_lock);
+}
+
+static int mon_seq_show(struct seq_file *m, void *v)
+{
+    struct mon_sample *smp = v;
+    int unusable, fragidx;
+    unsigned int z;
+    int order, mt;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_printf(m, "%s, %lu samples taken, every %d ms\n",
+                   mon_running ? "running" : "stopped", mon_head, mon_period_ms);
+        seq_printf(m, "order");
+        for (mt = 0; mt < MIGRATE_TYPES; mt++)
+            seq_printf(m, " %7s", mt_name(mt));
+        seq_printf(m, "  unusable fragidx\n");
+        return 0;
+    }
+
+    for (z = 0; z < mon_nr_zones; z++) {
+        const struct mon_zone *mz = &smp->zones[z];
+
+        seq_printf(m, "t=%llu ms node %d zone %s\n",
+                   div_u64(smp->time_ns, NSEC_PER_MSEC), mz->nid, mz->name);
+
+        for (order = 0; order < NR_PAGE_ORDERS; order++) {
+            seq_printf(m, "%5d", order);
+            for (mt = 0; mt < MIGRATE_TYPES; mt++)
+                seq_printf(m, " %7lu", mz->nr_free[order][mt]);
+
+            mon_indices(mz, order, &unusable, &fragidx);
+            seq_printf(m, "  %4d.%03d %s%d.%03d\n", unusable / 1000, unusable % 1000,
+                       fragidx < 0 ? "-" : " ", abs(fragidx) / 1000, abs(fragidx) % 1000);
+        }
+    }
+
+    return 0;
+}
+
+static const struct seq_operations mon_seq_ops = {
+    .start = mon_seq_start,
+    .next = mon_seq_next,
+    .stop = mon_seq_stop,
+    .show = mon_seq_show,
+};
+
+static int mon_open(struct inode *inode, struct file *file)
+{
+    return seq_open(file, &mon_seq_ops);
+}
+
+static void mon_stop(void)
+{
+    mutex_lock(&mon_lock);
+    mon_running = false;
+    mutex_unlock(&mon_lock);
+
+    cancel_delayed_work_sync(&mon_work);
+}
+
+static int mon_start(void)
+{
+    unsigned int zones = 0;
+    struct zone *zone;
+    int nid;
+
+    mon_stop();
+
+    for_each_populated_node_zone(nid, zone)
+        zones++;
+
+    mutex_lock(&mon_lock);
+
+    kvfree(mon_ring);
+    mon_nr_zones = zones;
+    mon_capacity = max(mon_samples, 1);
+    mon_sample_size = sizeof(struct mon_sample) + zones * sizeof(struct mon_zone);
+    mon_ring = kvcalloc(mon_capacity, mon_sample_size, GFP_KERNEL);
+    mon_head = 0;
+    if (!mon_ring) {
+        mutex_unlock(&mon_lock);
+        return -ENOMEM;
+    }
+
+    mon_running = true;
+    schedule_delayed_work(&mon_work, 0);
+
+    mutex_unlock(&mon_lock);
+    return 0;
+}
+
+/* Write 1 to (re)start sampling with the current parameters, 0 to stop */
+static ssize_t mon_write(struct file *file, const char __user *buf,
+                         size_t count, loff_t *ppos)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool_from_user(buf, count, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        ret = mon_start();
+    else
+        mon_stop();
+
+    return ret ? ret : count;
+}
+
+static const struct file_operations mon_fops = {
+    .owner = THIS_MODULE,
+    .open = mon_open,
+    .read = seq_read,
+    .write = mon_write,
+    .llseek = seq_lseek,
+    .release = seq_release,
+};
+
+static void mon_exit(void)
+{
+    mon_stop();
+    kvfree(mon_ring);
+}
+
+/* ---------- Compaction recovery ---------- */
+
+/* Free blocks of at least this order, all zones together */
+static unsigned long free_blocks_from(int order)
+{
+    unsigned long nr = 0;
+    struct zone *zone;
+    int nid, o;
+
+    for_each_populated_node_zone(nid, zone)
+        for (o = order; o < NR_PAGE_ORDERS; o++)
+            nr += READ_ONCE(zone->free_area[o].nr_free);
+
+    return nr;
+}
+
+/*
+ * Allocator running during compaction, as a driver would. Each attempt
+ * may stall in direct compaction/reclaim, which is what we measure.
+ */
+struct cmp_prober {
+    int order;
+    u64 t0;
+    u64 first_ok_ns;
+    u64 attempts;
+    u64 successes;
+    struct lat_hist stall;
+    struct task_struct *task;
+};
+
+static int cmp_prober_fn(void *data)
+{
+    struct cmp_prober *p = data;
+    struct page *page;
+    u64 t1, t2;
+
+    while (!kthread_should_stop()) {
+        t1 = ktime_get_ns();
+        page = alloc_pages(GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY, p->order);
+        t2 = ktime_get_ns();
+
+        hist_add(&p->stall, t2 - t1);
+        p->attempts++;
+
+        if (page) {
+            if (!p->successes)
+                WRITE_ONCE(p->first_ok_ns, t2 - p->t0);
+            p->successes++;
+            __free_pages(page, p->order);
+        }
+
+        usleep_range(500, 1000);
+    }
+
+    return 0;
+}
+
+/* Same as "echo 1 > /proc/sys/vm/compact_memory", synchronous */
+static int trigger_compaction(void)
+{
+    struct file *f;
+    loff_t pos = 0;
+    ssize_t ret;
+
+    f = filp_open("/proc/sys/vm/compact_memory", O_WRONLY, 0);
+    if (IS_ERR(f))
+        return PTR_ERR(f);
+
+    ret = kernel_write(f, "1\n", 2, &pos);
+    filp_close(f, NULL);
+
+    return ret < 0 ? ret : 0;
+}
+
+struct cmp_event {
+    const char *name;
+    enum vm_event_item item;
+};
+
+static const struct cmp_event cmp_events[] = {
+#ifdef CONFIG_COMPACTION
+    { "compact_stall", COMPACTSTALL },
+    { "compact_success", COMPACTSUCCESS },
+    { "compact_fail", COMPACTFAIL },
+    { "compact_migrate_scanned", COMPACTMIGRATE_SCANNED },
+    { "compact_free_scanned", COMPACTFREE_SCANNED },
+    { "compact_isolated", COMPACTISOLATED },
+#endif
+#ifdef CONFIG_MIGRATION
+    { "pgmigrate_success", PGMIGRATE_SUCCESS },
+    { "pgmigrate_fail", PGMIGRATE_FAIL },
+#endif
+};
+
+static int run_compaction_bench(struct seq_buf *s, const char *arg)
+{
+    unsigned long *ev_before, *ev_after;
+    struct cmp_prober *p;
+    struct lat_stats st;
+    u64 compact_ns, deadline;
+    int i, ret;
+
+    if (test_order < 0 || test_order > MAX_PAGE_ORDER)
+        return -EINVAL;
+
+    /* The experiment starts from a fragmented system */
+    if (!frag_active()) {
+        ret = fragment_memory();
+        if (ret)
+            return ret;
+    }
+
+    ev_before = kvcalloc(NR_VM_EVENT_ITEMS, sizeof(unsigned long), GFP_KERNEL);
+    ev_after = kvcalloc(NR_VM_EVENT_ITEMS, sizeof(unsigned long), GFP_KERNEL);
+    p = kzalloc(sizeof(*p), GFP_KERNEL);
+    if (!ev_before || !ev_after || !p) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    seq_buf_printf(s, "order %d: %lu free blocks before compaction\n",
+                   test_order, free_blocks_from(test_order));
+
+    p->order = test_order;
+    p->t0 = ktime_get_ns();
+    p->task = kthread_run(cmp_prober_fn, p, "kvv_cmp_probe");
+    if (IS_ERR(p->task)) {
+        ret = PTR_ERR(p->task);
+        goto out;
+    }
+
+    all_vm_events(ev_before);
+    ret = trigger_compaction();
+    compact_ns = ktime_get_ns() - p->t0;
+    all_vm_events(ev_after);
+
+    /* Give the prober time to succeed if compaction alone did not help */
+    deadline = p->t0 + (u64)cmp_timeout_ms * NSEC_PER_MSEC;
+    while (!READ_ONCE(p->first_ok_ns) && ktime_get_ns() < deadline &&
+           !fatal_signal_pending(current))
+        msleep(10);
+
+    kthread_stop(p->task);
+
+    if (ret) {
+        seq_buf_printf(s, "compaction trigger failed: %d\n", ret);
+        goto out;
+    }
+
+    seq_buf_printf(s, "compaction took %llu us, %lu free blocks after\n",
+                   div_u64(compact_ns, NSEC_PER_USEC), free_blocks_from(test_order));
+    if (p->successes)
+        seq_buf_printf(s, "first order-%d allocation after %llu us\n",
+                       test_order, div_u64(p->first_ok_ns, NSEC_PER_USEC));
+    else
+        seq_buf_printf(s, "no order-%d allocation within %d ms\n",
+                       test_order, cmp_timeout_ms);
+
+    seq_buf_printf(s, "prober: %llu attempts, %llu successes, stall ns:",
+                   p->attempts, p->successes);
+    hist_stats(&p->stall, &st);
+    print_stats(s, &st);
+    seq_buf_printf(s, "\n");
+
+    for (i = 0; i < ARRAY_SIZE(cmp_events); i++)
+        seq_buf_printf(s, "%-24s %lu\n", cmp_events[i].name,
+                       ev_after[cmp_events[i].item] - ev_before[cmp_events[i].item]);
+
+out:
+    kfree(p);
+    kvfree(ev_before);
+    kvfree(ev_after);
+    return ret;
+}
+
+/* ---------- Memory access cost ---------- */
+
+/* Keeps the compiler from dropping the loads we time */
+static u64 access_sink;
+
+struct access_result {
+    u64 seq_read_mbs;
+    u64 seq_write_mbs;
+    u64 rand_read_ns;   /* dependent loads, one per page */
+    u64 rand_write_ns;
+    u64 to_user_mbs;
+    u64 from_user_mbs;
+};
+
+static u64 mb_per_s(u64 bytes, u64 ns)
+{
+    return ns ? div64_u64(bytes * 1000, ns) : 0;
+}
+
+static u64 xorshift64(u64 *state)
+{
+    u64 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void access_seq(u64 *buf, size_t words, struct access_result *r)
+{
+    u64 t1, sum = 0;
+    size_t i;
+    int pass;
+
+    t1 = ktime_get_ns();
+    for (pass = 0; pass < access_passes; pass++)
+        for (i = 0; i < words; i++)
+            sum += buf[i];
+    r->seq_read_mbs = mb_per_s((u64)words * 8 * access_passes, ktime_get_ns() - t1);
+    WRITE_ONCE(access_sink, sum);
+
+    t1 = ktime_get_ns();
+    for (pass = 0; pass < access_passes; pass++)
+        for (i = 0; i < words; i++)
+            buf[i] = i;
+    r->seq_write_mbs = mb_per_s((u64)words * 8 * access_passes, ktime_get_ns() - t1);
+}
+
+/*
+ * Pointer chase through one cache line of every page, in random order:
+ * each load depends on the previous one, so its TLB and cache misses
+ * are not hidden.
+ */
+static int access_random(char *buf, size_t size, struct access_result *r)
+{
+    size_t pages = size / PAGE_SIZE, i, steps;
+    u64 seed = get_random_u64() | 1, t1, word;
+    void **node;
+    u32 *perm;
+
+    if (pages < 2)
+        return -EINVAL;
+
+    perm = kvmalloc_array(pages, sizeof(*perm), GFP_KERNEL);
+    if (!perm)
+        return -ENOMEM;
+
+    for (i = 0; i < pages; i++)
+        perm[i] = i;
+    for (i = pages - 1; i > 0; i--)
+        swap(perm[i], perm[get_random_u32_below(i + 1)]);
+
+#define CHASE_NODE(i) ((void **)(buf + (size_t)perm[i] * PAGE_SIZE + \
+                                 ((i) * L1_CACHE_BYTES) % PAGE_SIZE))
+    for (i = 0; i < pages; i++)
+        *CHASE_NODE(i) = CHASE_NODE((i + 1) % pages);
+    node = CHASE_NODE(0);
+#undef CHASE_NODE
+
+    steps = pages * access_passes;
+    t1 = ktime_get_ns();
+    for (i = 0; i < steps; i++)
+        node = *node;
+    r->rand_read_ns = div64_u64(ktime_get_ns() - t1, steps);
+    WRITE_ONCE(access_sink, (u64)(unsigned long)node);
+
+    steps = size / L1_CACHE_BYTES * access_passes;
+    t1 = ktime_get_ns();
+    for (i = 0; i < steps; i++) {
+        /* No open-coded 64-bit modulo, 32-bit ARM has no libgcc helper for it */
+        div64_u64_rem(xorshift64(&seed), size / 8, &word);
+        ((u64 *)buf)[word] = i;
+    }
+    r->rand_write_ns = div64_u64(ktime_get_ns() - t1, steps);
+
+    kvfree(perm);
+    return 0;
+}
+
+/* Runs in the writer's process, so a user buffer can be mapped in it */
+static int access_copy(char *buf, size_t size, struct access_result *r)
+{
+    size_t chunk = clamp_t(size_t, access_chunk, 1, size), off;
+    unsigned long ubuf;
+    u64 t1, bytes = 0;
+    int pass, ret = 0;
+
+    ubuf = vm_mmap(NULL, 0, size, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE, 0);
+    if (IS_ERR_VALUE(ubuf))
+        return ubuf;
+
+    /* Fault the user pages in, untimed */
+    if (copy_to_user((void __user *)ubuf, buf, size)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    t1 = ktime_get_ns();
+    for (pass = 0; pass < access_passes; pass++)
+        for (off = 0; off + chunk <= size; off += chunk, bytes += chunk)
+            if (copy_to_user((void __user *)(ubuf + off), buf + off, chunk))
+                ret = -EFAULT;
+    r->to_user_mbs = mb_per_s(bytes, ktime_get_ns() - t1);
+
+    bytes = 0;
+    t1 = ktime_get_ns();
+    for (pass = 0; pass < access_passes; pass++)
+        for (off = 0; off + chunk <= size; off += chunk, bytes += chunk)
+            if (copy_from_user(buf + off, (void __user *)(ubuf + off), chunk))
+                ret = -EFAULT;
+    r->from_user_mbs = mb_per_s(bytes, ktime_get_ns() - t1);
+
+out:
+    vm_munmap(ubuf, size);
+    return ret;
+}
+
+enum access_kind {
+    ACCESS_LINEAR,
+    ACCESS_VMALLOC,
+    ACCESS_VMALLOC_HUGE,
+};
+
+static const char * const access_names[] = {
+    [ACCESS_LINEAR] = "linear",
+    [ACCESS_VMALLOC] = "vmalloc",
+    [ACCESS_VMALLOC_HUGE] = "vmalloc_huge",
+};
+
+static int run_access_bench(struct seq_buf *s, const char *arg)
+{
+    size_t size = PAGE_ALIGN(access_size);
+    int order = get_order(size);
+    struct access_result r;
+    struct page *page;
+    int kind, ret = 0;
+    char *buf;
+
+    if (size < 2 * PAGE_SIZE || access_passes < 1)
+        return -EINVAL;
+
+    seq_buf_printf(s, "%zu bytes, %d passes, copies of %lu bytes\n",
+                   size, access_passes, access_chunk);
+    seq_buf_printf(s, "%-13s %10s %10s %10s %10s %10s %10s\n", "buffer",
+                   "rd MB/s", "wr MB/s", "rnd rd ns", "rnd wr ns",
+                   "to_user", "from_user");
+
+    for (kind = 0; kind < ARRAY_SIZE(access_names); kind++) {
+        page = NULL;
+
+        switch (kind) {
+        case ACCESS_LINEAR:
+            /* Physically contiguous, reached through the linear map */
+            if (order > MAX_PAGE_ORDER) {
+                seq_buf_printf(s, "%-13s too large for the buddy allocator\n",
+                               access_names[kind]);
+                continue;
+            }
+            page = alloc_pages(GFP_KERNEL | __GFP_NOWARN, order);
+            buf = page ? page_address(page) : NULL;
+            break;
+        case ACCESS_VMALLOC:
+            buf = vmalloc(size);
+            break;
+        default:
+            /* Falls back to small pages where huge vmalloc is not supported */
+            buf = vmalloc_huge(size, GFP_KERNEL);
+            break;
+        }
+
+        if (!buf) {
+            seq_buf_printf(s, "%-13s allocation failed\n", access_names[kind]);
+            continue;
+        }
+
+        memset(&r, 0, sizeof(r));
+        access_seq((u64 *)buf, size / 8, &r);
+        ret = access_random(buf, size, &r);
+        if (!ret)
+            ret = access_copy(buf, size, &r);
+
+        if (page)
+            __free_pages(page, order);
+        else
+            vfree(buf);
+
+        if (ret)
+            break;
+
+        seq_buf_printf(s, "%-13s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                       access_names[kind], r.seq_read_mbs, r.seq_write_mbs,
+                       r.rand_read_ns, r.rand_write_ns, r.to_user_mbs, r.from_user_mbs);
+
+        if (fatal_signal_pending(current))
+            return -EINTR;
+    }
+
+    return ret;
+}
+
+/* ---------- GFP context matrix ---------- */
+
+enum matrix_ctx {
+    MATRIX_PROCESS,
+    MATRIX_SOFTIRQ,   /* timer_list callback */
+    MATRIX_HARDIRQ,   /* hrtimer callback in hard interrupt context */
+};
+
+static const char * const matrix_ctx_names[] = {
+    [MATRIX_PROCESS] = "process",
+    [MATRIX_SOFTIRQ] = "softirq",
+    [MATRIX_HARDIRQ] = "hardirq",
+};
+
+struct matrix_flags {
+    const char *name;
+    gfp_t gfp;
+    bool atomic;    /* may be used from interrupt context */
+};
+
+static const struct matrix_flags matrix_flags[] = {
+    { "GFP_ATOMIC", GFP_ATOMIC, true },
+    { "GFP_NOWAIT", GFP_NOWAIT, true },
+    { "GFP_KERNEL", GFP_KERNEL, false },
+    { "KERNEL|NORETRY", GFP_KERNEL | __GFP_NORETRY, false },
+    { "KERNEL|RETRY_MAYFAIL", GFP_KERNEL | __GFP_RETRY_MAYFAIL, false },
+};
+
+struct matrix_cell {
+    gfp_t gfp;
+    int order;
+    unsigned int iters;     /* matrix_iters when the run started */
+    unsigned int n;
+    unsigned int ok;
+    u64 *ns;
+    struct completion done;
+    struct timer_list timer;
+    struct hrtimer hrtimer;
+};
+
+static void matrix_one(struct matrix_cell *c)
+{
+    struct page *page;
+    u64 t1, t2;
+
+    t1 = ktime_get_ns();
+    page = alloc_pages(c->gfp | __GFP_NOWARN, c->order);
+    t2 = ktime_get_ns();
+
+    c->ns[c->n++] = t2 - t1;
+    if (page) {
+        c->ok++;
+        __free_pages(page, c->order);
+    }
+}
+
+/* One allocation per expiry, re-armed until the cell is complete */
+static void matrix_timer_fn(struct timer_list *t)
+{
+    struct matrix_cell *c = from_timer(c, t, timer);
+
+    matrix_one(c);
+    if (c->n < c->iters)
+        mod_timer(&c->timer, jiffies + 1);
+    else
+        complete(&c->done);
+}
+
+static enum hrtimer_restart matrix_hrtimer_fn(struct hrtimer *t)
+{
+    struct matrix_cell *c = container_of(t, struct matrix_cell, hrtimer);
+
+    matrix_one(c);
+    if (c->n < c->iters) {
+        hrtimer_forward_now(t, us_to_ktime(50));
+        return HRTIMER_RESTART;
+    }
+
+    complete(&c->done);
+    return HRTIMER_NORESTART;
+}
+
+static void matrix_cell_run(struct matrix_cell *c, enum matrix_ctx ctx)
+{
+    c->n = c->ok = 0;
+    init_completion(&c->done);
+
+    switch (ctx) {
+    case MATRIX_PROCESS:
+        while (c->n < c->iters) {
+            matrix_one(c);
+            cond_resched();
+        }
+        break;
+    case MATRIX_SOFTIRQ:
+        timer_setup(&c->timer, matrix_timer_fn, 0);
+        mod_timer(&c->timer, jiffies + 1);
+        wait_for_completion(&c->done);
+        del_timer_sync(&c->timer);
+        break;
+    case MATRIX_HARDIRQ:
+        hrtimer_init(&c->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+        c->hrtimer.function = matrix_hrtimer_fn;
+        hrtimer_start(&c->hrtimer, us_to_ktime(50), HRTIMER_MODE_REL_HARD);
+        wait_for_completion(&c->done);
+        hrtimer_cancel(&c->hrtimer);
+        break;
+    }
+}
+
+static int matrix_run(struct seq_buf *s, struct matrix_cell *c, const char *state)
+{
+    int max_order = clamp(matrix_max_order, 0, MAX_PAGE_ORDER);
+    struct lat_stats st;
+    int ctx, f;
+
+    seq_buf_printf(s, "state: %s, %u allocations per cell\n", state, c->iters);
+    seq_buf_printf(s, "%-8s %-21s %5s %7s | %-38s\n", "context", "flags", "order",
+                   "success", "ns: min median p99 max");
+
+    for (ctx = 0; ctx < ARRAY_SIZE(matrix_ctx_names); ctx++) {
+        for (f = 0; f < ARRAY_SIZE(matrix_flags); f++) {
+            if (ctx != MATRIX_PROCESS && !matrix_flags[f].atomic)
+                continue;
+
+            for (c->order = 0; c->order <= max_order; c->order++) {
+                c->gfp = matrix_flags[f].gfp;
+                matrix_cell_run(c, ctx);
+
+                seq_buf_printf(s, "%-8s %-21s %5d %6u%% |", matrix_ctx_names[ctx],
+                               matrix_flags[f].name, c->order, c->ok * 100 / c->n);
+                compute_stats(c->ns, c->n, &st);
+                print_stats(s, &st);
+                seq_buf_printf(s, "\n");
+
+                if (fatal_signal_pending(current))
+                    return -EINTR;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Runs the matrix in the current state. With "both", the current state
+ * must be unfragmented, and the matrix runs again after fragment_memory().
+ */
+static int run_gfp_matrix(struct seq_buf *s, const char *arg)
+{
+    bool both = !strcmp(arg, "both");
+    struct matrix_cell *c;
+    int ret;
+
+    if (matrix_iters < 1)
+        return -EINVAL;
+    if (both && frag_active())
+        return -EBUSY;
+
+    c = kzalloc(sizeof(*c), GFP_KERNEL);
+    if (!c)
+        return -ENOMEM;
+    c->iters = matrix_iters;
+    c->ns = kvmalloc_array(c->iters, sizeof(u64), GFP_KERNEL);
+    if (!c->ns) {
+        kfree(c);
+        return -ENOMEM;
+    }
+
+    ret = matrix_run(s, c, frag_active() ? "fragmented" : "unfragmented");
+
+    if (!ret && both) {
+        ret = fragment_memory();
+        if (!ret) {
+            seq_buf_printf(s, "\n");
+            ret = matrix_run(s, c, "fragmented");
+        }
+    }
+
+    kvfree(c->ns);
+    kfree(c);
+    return ret;
+}
+
+/* ---------- Deferred (RCU) free ---------- */
+
+struct rcu_obj {
+    struct rcu_head rcu;
+    u64 queued_ns;
+    struct rcu_obj *next;   /* rest of the batch, on the batch head */
+};
+
+enum rcu_mode {
+    RCU_KFREE,
+    RCU_KFREE_RCU,
+    RCU_CALL_RCU,
+    RCU_CALL_RCU_BATCH,
+};
+
+static const char * const rcu_mode_names[] = {
+    [RCU_KFREE] = "kfree",
+    [RCU_KFREE_RCU] = "kfree_rcu",
+    [RCU_CALL_RCU] = "call_rcu",
+    [RCU_CALL_RCU_BATCH] = "call_rcu_batch",
+};
+
+/* Objects queued and not yet freed by a callback */
+static atomic_long_t rcu_outstanding;
+/* Grace period latency seen by callbacks, which run on any CPU */
+static struct lat_hist rcu_gp_lat;
+static DEFINE_SPINLOCK(rcu_gp_lock);
+
+static void rcu_obj_free_cb(struct rcu_head *head)
+{
+    struct rcu_obj *obj = container_of(head, struct rcu_obj, rcu), *next;
+    u64 ns = ktime_get_ns() - obj->queued_ns;
+    unsigned long flags;
+    long nr = 0;
+
+    spin_lock_irqsave(&rcu_gp_lock, flags);
+    hist_add(&rcu_gp_lat, ns);
+    spin_unlock_irqrestore(&rcu_gp_lock, flags);
+
+    for (; obj; obj = next, nr++) {
+        next = obj->next;
+        kfree(obj);
+    }
+    atomic_long_sub(nr, &rcu_outstanding);
+}
+
+static unsigned long slab_bytes(void)
+{
+    return global_node_page_state_pages(NR_SLAB_UNRECLAIMABLE_B) * PAGE_SIZE;
+}
+
+static int rcu_mode_run(struct seq_buf *s, enum rcu_mode mode)
+{
+    size_t size = max_t(size_t, rcu_size, sizeof(struct rcu_obj));
+    unsigned long base = slab_bytes(), peak = 0, held;
+    struct rcu_obj *obj, *batch = NULL;
+    unsigned int in_batch = 0;
+    u64 t1, issue_ns, drain_ns;
+    struct lat_stats st;
+    long i, n = rcu_objects;
+
+    memset(&rcu_gp_lat, 0, sizeof(rcu_gp_lat));
+    atomic_long_set(&rcu_outstanding, 0);
+
+    t1 = ktime_get_ns();
+    for (i = 0; i < n; i++) {
+        obj = kmalloc(size, GFP_KERNEL);
+        if (!obj)
+            break;
+
+        obj->next = NULL;
+        obj->queued_ns = ktime_get_ns();
+
+        switch (mode) {
+        case RCU_KFREE:
+            kfree(obj);
+            break;
+        case RCU_KFREE_RCU:
+            kfree_rcu(obj, rcu);
+            break;
+        case RCU_CALL_RCU:
+            atomic_long_inc(&rcu_outstanding);
+            call_rcu(&obj->rcu, rcu_obj_free_cb);
+            break;
+        case RCU_CALL_RCU_BATCH:
+            atomic_long_inc(&rcu_outstanding);
+            obj->next = batch;
+            batch = obj;
+            if (++in_batch >= rcu_batch) {
+                call_rcu(&batch->rcu, rcu_obj_free_cb);
+                batch = NULL;
+                in_batch = 0;
+            }
+            break;
+        }
+
+        /* Memory waiting for a grace period */
+        if (!(i & 1023)) {
+            if (mode == RCU_KFREE_RCU)
+                held = slab_bytes() > base ? slab_bytes() - base : 0;
+            else
+                held = atomic_long_read(&rcu_outstanding) * size;
+            peak = max(peak, held);
+            cond_resched();
+        }
+    }
+    if (batch)
+        call_rcu(&batch->rcu, rcu_obj_free_cb);
+    issue_ns = ktime_get_ns() - t1;
+
+    /*
+     * call_rcu() callbacks are waited for exactly. kfree_rcu() gives no
+     * completion, the slab is polled until it is back to its size before.
+     */
+    t1 = ktime_get_ns();
+    if (mode == RCU_KFREE_RCU) {
+        while (slab_bytes() > base + (peak >> 4) &&
+               ktime_get_ns() - t1 < 10 * NSEC_PER_SEC)
+            msleep(1);
+    } else {
+        rcu_barrier();
+    }
+    drain_ns = ktime_get_ns() - t1;
+
+    seq_buf_printf(s, "%-14s %8ld %10llu %10lu %9llu |", rcu_mode_names[mode], i,
+                   div64_u64((u64)i * NSEC_PER_SEC, max(issue_ns, 1ULL)),
+                   peak >> 10, div_u64(drain_ns, NSEC_PER_USEC));
+    hist_stats(&rcu_gp_lat, &st);
+    print_stats(s, &st);
+    seq_buf_printf(s, "\n");
+
+    return i < n ? -ENOMEM : 0;
+}
+
+static int run_rcu_bench(struct seq_buf *s, const char *arg)
+{
+    u64 t1, gp_ns;
+    int mode, ret = 0;
+
+    if (rcu_objects < 1 || rcu_batch < 1)
+        return -EINVAL;
+
+    t1 = ktime_get_ns();
+    synchronize_rcu();
+    gp_ns = ktime_get_ns() - t1;
+
+    seq_buf_printf(s, "%d objects of %lu bytes, batches of %d, synchronize_rcu() %llu us\n",
+                   rcu_objects, rcu_size, rcu_batch, div_u64(gp_ns, NSEC_PER_USEC));
+    seq_buf_printf(s, "%-14s %8s %10s %10s %9s | %-38s\n", "mode", "objects",
+                   "frees/s", "peak KiB", "drain us", "grace period ns: min median p99 max");
+
+    for (mode = 0; mode < ARRAY_SIZE(rcu_mode_names); mode++) {
+        if (*arg && strcmp(arg, "all") && strcmp(arg, rcu_mode_names[mode]))
+            continue;
+
+        ret = rcu_mode_run(s, mode);
+        if (ret || fatal_signal_pending(current))
+            break;
+    }
+
+    return ret;
+}
+
+/* ---------- debugfs reporting ---------- */
+
+#define REPORT_SIZE (256 * 1024)
+#define BENCH_ARG_LEN 64
+
+/*
+ * Each benchmark is a debugfs file: writing runs it (the written word is
+ * passed as argument, e.g. an allocator name) and reading returns the
+ * report of the last run.
+ */
+struct bench {
+    const char *name;
+    int (*run)(struct seq_buf *s, const char *arg);
+    char *report;
+    size_t report_len;
+};
+
+static struct bench benches[] = {
+    { .name = "alloc_bench", .run = run_alloc_bench },
+    { .name = "scale_bench", .run = run_scale_bench },
+    { .name = "compaction", .run = run_compaction_bench },
+    { .name = "access_bench", .run = run_access_bench },
+    { .name = "gfp_matrix", .run = run_gfp_matrix },
+    { .name = "fragment", .run = run_fragment },
+    { .name = "rcu_bench", .run = run_rcu_bench },
+};
+
+/* One benchmark at a time, they would disturb each other */
+static DEFINE_MUTEX(bench_lock);
+
+static ssize_t bench_read(struct file *file, char __user *buf,
+                          size_t count, loff_t *ppos)
+{
+    struct bench *b = file->private_data;
+    ssize_t ret;
+
+    if (mutex_lock_interruptible(&bench_lock))
+        return -EINTR;
+
+    ret = simple_read_from_buffer(buf, count, ppos, b->report, b->report_len);
+
+    mutex_unlock(&bench_lock);
+    return ret;
+}
+
+static ssize_t bench_write(struct file *file, const char __user *buf,
+                           size_t count, loff_t *ppos)
+{
+    struct bench *b = file->private_data;
+    char arg[BENCH_ARG_LEN];
+    struct seq_buf s;
+    char *report;
+    size_t len = min(count, sizeof(arg) - 1);
+    int ret;
+
+    if (copy_from_user(arg, buf, len))
+        return -EFAULT;
+    arg[len] = '\0';
+
+    report = kvmalloc(REPORT_SIZE, GFP_KERNEL);
+    if (!report)
+        return -ENOMEM;
+    seq_buf_init(&s, report, REPORT_SIZE);
+
+    if (mutex_lock_interruptible(&bench_lock)) {
+        kvfree(report);
+        return -EINTR;
+    }
+
+    ret = b->run(&s, strim(arg));
+    if (seq_buf_has_overflowed(&s))
+        pr_warn("%s: report truncated\n", b->name);
+
+    kvfree(b->report);
+    b->report = report;
+    b->report_len = seq_buf_used(&s);
+
+    mutex_unlock(&bench_lock);
+
+    return ret ? ret : count;
+}
+
+static const struct file_operations bench_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = bench_read,
+    .write = bench_write,
+    .llseek = default_llseek,
+};
+
+static void bench_debugfs_init(void)
+{
+    int i;
+
+    debugfs_dir = debugfs_create_dir("kmalloc_vs_vmalloc", NULL);
+
+    for (i = 0; i < ARRAY_SIZE(benches); i++)
+        debugfs_create_file(benches[i].name, 0600, debugfs_dir,
+                            &benches[i], &bench_fops);
+
+    INIT_DELAYED_WORK(&mon_work, mon_work_fn);
+    debugfs_create_file("frag_monitor", 0600, debugfs_dir, NULL, &mon_fops);
+}
+
+static void bench_debugfs_exit(void)
+{
+    int i;
+
+    debugfs_remove_recursive(debugfs_dir);
+    mon_exit();
+    /* No rcu_bench callback may run once the module is gone */
+    rcu_barrier();
+
+    for (i = 0; i < ARRAY_SIZE(benches); i++)
+        kvfree(benches[i].report);
+}
+
+/* ---------- Init / Exit ---------- */
+
+static int __init demo_init(void)
+{
+    /* The debugfs files are only created once the demo is done, a write to
+     * them would otherwise run a benchmark on top of it */
+    if (!demo)
+        goto out;
+
+    pr_info("=== kmalloc vs vmalloc + buddy histogram demo ===\n");
+
+    print_all_zones("BEFORE");
+
+    if (fragment_memory()) {
+        pr_err("Fragmentation failed\n");
+        frag_release();
+        return -ENOMEM;
+    }
+
+    print_all_zones("AFTER_FRAG");
+
+    run_test();
+
+    print_all_zones("AFTER_TEST");
+
+out:
+    bench_debugfs_init();
+    return 0;
+}
+
+static void __exit demo_exit(void)
+{
+    bench_debugfs_exit();
+    frag_release();
+
     pr_info("Demo exit\n");
 }
 
@@ -5,6 +5,8 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
 
 #define DEVICE_NAME "leaky_dev"
 #define CLASS_NAME  "leaky"
@@ -12,6 +14,38 @@
 static char *buffer;
 static size_t buffer_size = 1024;
 
+/* Where a file gets its buffer from, sampled at open() */
+enum alloc_mode {
+    ALLOC_GLOBAL,   /* one lazily kmalloc'ed buffer shared by every opener */
+    ALLOC_KMALLOC,  /* private buffer per open, kzalloc'ed */
+    ALLOC_CACHE,    /* private buffer per open, from leaky_cache */
+};
+
+static int alloc_mode = ALLOC_GLOBAL;
+static bool cache_ctor;
+static bool zero_on_free = true;
+static bool debug_dump;
+
+/* Per-open buffer, header and data come from a single allocation */
+struct leaky_buf {
+    int mode;
+    size_t size;
+    char data[];
+};
+
+static struct kmem_cache *leaky_cache;
+static size_t cache_buf_size;
+
+/* The global buffer can be freed by the shrinker while nobody has it open,
+ * so it is only touched under buffer_lock. */
+static DEFINE_MUTEX(buffer_lock);
+static atomic_t global_users = ATOMIC_INIT(0);
+static bool buffer_reclaimed;
+static struct shrinker *leaky_shrinker;
+
+static unsigned long reclaimed_bytes;
+static unsigned long refaulted_bytes;
+
 /* Vars for device and device class */
 static dev_t my_device_number;
 static struct class *my_class;
@@ -19,52 +53,199 @@ static struct cdev my_device;
 
 module_param(buffer_size, ulong, 0644);
 MODULE_PARM_DESC(buffer_size, "Size of the internal buffer");
+module_param(alloc_mode, int, 0644);
+MODULE_PARM_DESC(alloc_mode, "0: global buffer, 1: per-open kmalloc, 2: per-open kmem_cache");
+module_param(cache_ctor, bool, 0444);
+MODULE_PARM_DESC(cache_ctor, "Zero kmem_cache objects once, in a constructor (implied by zero_on_free)");
+module_param(zero_on_free, bool, 0444);
+MODULE_PARM_DESC(zero_on_free, "Clear kmem_cache buffers before giving them back");
+module_param(debug_dump, bool, 0644);
+MODULE_PARM_DESC(debug_dump, "Hex dump the buffer on every read");
+module_param(reclaimed_bytes, ulong, 0444);
+MODULE_PARM_DESC(reclaimed_bytes, "Bytes of idle global buffer freed under memory pressure");
+module_param(refaulted_bytes, ulong, 0444);
+MODULE_PARM_DESC(refaulted_bytes, "Bytes reallocated on write after a reclaim");
+
+/* Objects start zeroed. With zero_on_free they also go back to the cache
+ * zeroed, so allocation does not have to clear them again. zero_on_free
+ * relies on it, objects never used before would not be clean otherwise. */
+static void leaky_cache_ctor(void *obj)
+{
+    memset(obj, 0, sizeof(struct leaky_buf) + cache_buf_size);
+}
 
 static ssize_t dev_read(struct file *file, char __user *user_buf,
                         size_t len, loff_t *offset)
 {
+    struct leaky_buf *lb = file->private_data;
+    size_t size = lb ? lb->size : buffer_size;
     size_t to_copy;
+    ssize_t ret;
+    char *buf;
 
-    if (*offset >= buffer_size)
-        return 0;
+    if (!lb && mutex_lock_interruptible(&buffer_lock))
+        return -EINTR;
 
-    to_copy = min(len, buffer_size - *offset);
+    /* Global buffer reclaimed and not written since: nothing to read */
+    if (!lb && !buffer) {
+        ret = 0;
+        goto out;
+    }
+    buf = lb ? lb->data : buffer;
 
-    print_hex_dump(KERN_INFO, "leak: ", DUMP_PREFIX_OFFSET, 16, 1, buffer, buffer_size, true);
-    if (copy_to_user(user_buf, buffer + *offset, to_copy))
-        return -EFAULT;
+    if (*offset >= size) {
+        ret = 0;
+        goto out;
+    }
+
+    to_copy = min(len, size - *offset);
+
+    if (debug_dump)
+        print_hex_dump(KERN_INFO, "leak: ", DUMP_PREFIX_OFFSET, 16, 1, buf, size, true);
+    if (copy_to_user(user_buf, buf + *offset, to_copy)) {
+        ret = -EFAULT;
+        goto out;
+    }
 
     *offset += to_copy;
-    return to_copy;
+    ret = to_copy;
+out:
+    if (!lb)
+        mutex_unlock(&buffer_lock);
+    return ret;
 }
 
 static ssize_t dev_write(struct file *file, const char __user *user_buf,
                          size_t len, loff_t *offset)
 {
-    size_t to_copy = min(len, buffer_size);
+    struct leaky_buf *lb = file->private_data;
+    size_t to_copy;
 
-    if (!buffer)
+    if (lb) {
+        to_copy = min(len, lb->size);
+        if (copy_from_user(lb->data, user_buf, to_copy))
+            return -EFAULT;
+        return to_copy;
+    }
+
+    to_copy = min(len, buffer_size);
+
+    if (mutex_lock_interruptible(&buffer_lock))
+        return -EINTR;
+
+    if (!buffer) {
         buffer = kmalloc(buffer_size, GFP_KERNEL);
+        if (buffer && buffer_reclaimed) {
+            refaulted_bytes += buffer_size;
+            buffer_reclaimed = false;
+        }
+    }
 
-    if (!buffer)
+    if (!buffer) {
+        mutex_unlock(&buffer_lock);
         return -ENOMEM;
+    }
 
-    if (copy_from_user(buffer, user_buf, to_copy))
+    if (copy_from_user(buffer, user_buf, to_copy)) {
+        mutex_unlock(&buffer_lock);
         return -EFAULT;
+    }
 
+    mutex_unlock(&buffer_lock);
     return to_copy;
 }
 
 static int dev_open(struct inode *inodep, struct file *filep)
 {
+    int mode = READ_ONCE(alloc_mode);
+    struct leaky_buf *lb;
+
+    switch (mode) {
+    case ALLOC_KMALLOC:
+        lb = kzalloc(struct_size(lb, data, buffer_size), GFP_KERNEL);
+        if (!lb)
+            return -ENOMEM;
+        lb->size = buffer_size;
+        break;
+    case ALLOC_CACHE:
+        lb = kmem_cache_alloc(leaky_cache, GFP_KERNEL);
+        if (!lb)
+            return -ENOMEM;
+        /* Cleared in one place only: on free with zero_on_free, here
+         * otherwise */
+        if (!zero_on_free)
+            memset(lb->data, 0, cache_buf_size);
+        lb->size = cache_buf_size;
+        break;
+    default:
+        lb = NULL;
+        break;
+    }
+
+    if (lb)
+        lb->mode = mode;
+    else
+        atomic_inc(&global_users);
+    filep->private_data = lb;
     return 0;
 }
 
 static int dev_release(struct inode *inodep, struct file *filep)
 {
+    struct leaky_buf *lb = filep->private_data;
+
+    if (!lb) {
+        atomic_dec(&global_users);
+        return 0;
+    }
+
+    if (lb->mode == ALLOC_CACHE) {
+        if (zero_on_free)
+            memset(lb->data, 0, lb->size);
+        kmem_cache_free(leaky_cache, lb);
+    } else {
+        kfree(lb);
+    }
+
     return 0;
 }
 
+/* The global buffer is idle while no file using it is open. Under memory
+ * pressure it is freed, and dev_write() allocates it again.
+ *
+ * Counts are in bytes and seeks is 0, the buffer being cheap to allocate
+ * again: the shrinker core then scans half of the count at every reclaim
+ * priority, instead of shifting it down by the priority, which would leave
+ * a buffer of a few KiB alone until the very last one. */
+static unsigned long leaky_shrink_count(struct shrinker *shrink,
+                                        struct shrink_control *sc)
+{
+    if (!READ_ONCE(buffer) || atomic_read(&global_users))
+        return SHRINK_EMPTY;
+
+    return buffer_size;
+}
+
+static unsigned long leaky_shrink_scan(struct shrinker *shrink,
+                                       struct shrink_control *sc)
+{
+    unsigned long freed = 0;
+
+    if (!mutex_trylock(&buffer_lock))
+        return SHRINK_STOP;
+
+    if (buffer && !atomic_read(&global_users)) {
+        kfree(buffer);
+        buffer = NULL;
+        buffer_reclaimed = true;
+        reclaimed_bytes += buffer_size;
+        freed = buffer_size;
+    }
+
+    mutex_unlock(&buffer_lock);
+    return freed;
+}
+
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .read = dev_read,
@@ -75,8 +256,30 @@ static struct file_operations fops = {
 
 static int __init leaky_init(void)
 {
+    cache_buf_size = buffer_size;
+    leaky_cache = kmem_cache_create("leaky_buf",
+                                    sizeof(struct leaky_buf) + cache_buf_size,
+                                    0, SLAB_HWCACHE_ALIGN,
+                                    (cache_ctor || zero_on_free) ?
+                                    leaky_cache_ctor : NULL);
+    if (!leaky_cache) {
+        pr_err("Buffer cache could not be created\n");
+        return -ENOMEM;
+    }
+
+    leaky_shrinker = shrinker_alloc(0, "leaky_dev");
+    if (!leaky_shrinker) {
+        kmem_cache_destroy(leaky_cache);
+        return -ENOMEM;
+    }
+    leaky_shrinker->count_objects = leaky_shrink_count;
+    leaky_shrinker->scan_objects = leaky_shrink_scan;
+    leaky_shrinker->seeks = 0;
+
     if( alloc_chrdev_region(&my_device_number, 0, 1, DEVICE_NAME) < 0) {
         pr_err("Device number could not be allocated\n");
+        shrinker_free(leaky_shrinker);
+        kmem_cache_destroy(leaky_cache);
         return -1;
     }
 
@@ -98,6 +301,7 @@ static int __init leaky_init(void)
     }
 
     buffer = kmalloc(buffer_size, GFP_KERNEL);
+    shrinker_register(leaky_shrinker);
 
     pr_info("Leaky device is ready to go.");
 
@@ -111,16 +315,20 @@ static int __init leaky_init(void)
 
    ClassError:
     unregister_chrdev(my_device_number, DEVICE_NAME);
+    shrinker_free(leaky_shrinker);
+    kmem_cache_destroy(leaky_cache);
     return -1;
 }
 
 static void __exit leaky_exit(void)
 {
+    shrinker_free(leaky_shrinker);
     kfree(buffer);
     cdev_del(&my_device);
 	device_destroy(my_class, my_device_number);
 	class_destroy(my_class);
 	unregister_chrdev(my_device_number, DEVICE_NAME);
+    kmem_cache_destroy(leaky_cache);
     pr_info("unloaded\n");
 }
 
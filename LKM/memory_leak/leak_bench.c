@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define DEV "/dev/leaky_dev"
+#define MODE_PARAM "/sys/module/buggy_leaky_device/parameters/alloc_mode"
+
+#define DEFAULT_CYCLES 100000
+
+static const char *mode_names[] = {
+    "global kmalloc",
+    "per-open kmalloc",
+    "per-open kmem_cache",
+};
+
+void die(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Needs root, returns -1 if the parameter can't be written */
+static int set_mode(int mode)
+{
+    FILE *f = fopen(MODE_PARAM, "w");
+
+    if (!f)
+        return -1;
+
+    fprintf(f, "%d\n", mode);
+    return fclose(f);
+}
+
+/* One cycle is what a short-lived client does: open, write, read, close */
+static double run_cycles(long cycles)
+{
+    const char msg[] = "benchmark payload";
+    char buf[256];
+    double start = now_ns();
+
+    for (long i = 0; i < cycles; i++) {
+        int fd = open(DEV, O_RDWR);
+
+        if (fd < 0)
+            die("open");
+        if (write(fd, msg, sizeof(msg)) < 0)
+            die("write");
+        if (read(fd, buf, sizeof(buf)) < 0)
+            die("read");
+        close(fd);
+    }
+
+    return (now_ns() - start) / cycles;
+}
+
+int main(int argc, char *argv[])
+{
+    long cycles = argc > 1 ? atol(argv[1]) : DEFAULT_CYCLES;
+
+    if (cycles <= 0) {
+        fprintf(stderr, "usage: %s [cycles]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("=== open/write/read/close benchmark, %ld cycles ===\n", cycles);
+
+    for (int mode = 0; mode < 3; mode++) {
+        if (set_mode(mode) < 0) {
+            printf("[!] can't set %s, measuring the current mode only\n", MODE_PARAM);
+            printf("[+] current mode: %.0f ns/cycle\n", run_cycles(cycles));
+            return 0;
+        }
+
+        /* Warm up caches and the slab before measuring */
+        run_cycles(cycles / 10 + 1);
+        printf("[+] %-20s %8.0f ns/cycle\n", mode_names[mode], run_cycles(cycles));
+    }
+
+    set_mode(0);
+    return 0;
+}
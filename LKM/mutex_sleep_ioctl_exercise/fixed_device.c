@@ -7,6 +7,8 @@
 #include <linux/mutex.h>
 #include <linux/wait.h>
 #include <linux/cdev.h>
+#include <linux/slab.h>
+#include <linux/atomic.h>
 
 #define DEVICE_NAME "fixed_dev"
 #define CLASS_NAME  "fixed_class"
@@ -16,6 +18,12 @@
 #define MY_IOCTL_MAGIC 'k'
 #define IOCTL_RESET _IO(MY_IOCTL_MAGIC, 0)
 #define IOCTL_SET_BLOCKING _IOW(MY_IOCTL_MAGIC, 1, int)
+#define IOCTL_GET_STATS _IOR(MY_IOCTL_MAGIC, 2, struct fixed_stats)
+
+struct fixed_stats {
+    __u64 eagain;         // -EAGAIN returned to non-blocking openers
+    __u64 blocking_waits; // reads that slept instead of failing
+};
 
 static dev_t dev_num;
 static struct cdev my_cdev;
@@ -24,22 +32,51 @@ static struct class *my_class;
 // ==== SHARED STATE ====
 static char buffer[BUF_SIZE];
 static size_t data_size = 0;
-static int blocking_mode = 1;
 
 static DEFINE_MUTEX(lock);
 static wait_queue_head_t read_queue;
 
+// ==== STATS ====
+// A blocking wait is a read that, with the old global blocking_mode, could
+// have bounced with -EAGAIN because another opener switched the mode.
+static atomic64_t stat_eagain = ATOMIC64_INIT(0);
+static atomic64_t stat_blocking_waits = ATOMIC64_INIT(0);
+
+// ==== PER-FILE CONTEXT ====
+// The blocking mode lives in file->f_flags (O_NONBLOCK), so open() flags,
+// fcntl(F_SETFL) and IOCTL_SET_BLOCKING all act on this opener only.
+struct file_ctx {
+    u64 eagain;
+};
+
+static bool file_nonblocking(struct file *file)
+{
+    return READ_ONCE(file->f_flags) & O_NONBLOCK;
+}
+
 // ==== OPEN ====
 static int my_open(struct inode *inode, struct file *file)
 {
+    struct file_ctx *ctx;
+
     printk(KERN_INFO "fixed_dev: open\n");
+
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return -ENOMEM;
+
+    file->private_data = ctx;
     return 0;
 }
 
 // ==== RELEASE ====
 static int my_release(struct inode *inode, struct file *file)
 {
-    printk(KERN_INFO "fixed_dev: release\n");
+    struct file_ctx *ctx = file->private_data;
+
+    printk(KERN_INFO "fixed_dev: release (%llu EAGAIN)\n", ctx->eagain);
+
+    kfree(ctx);
     return 0;
 }
 
@@ -47,21 +84,27 @@ static int my_release(struct inode *inode, struct file *file)
 static ssize_t my_read(struct file *file, char __user *user_buf,
                        size_t count, loff_t *ppos)
 {
+    struct file_ctx *ctx = file->private_data;
     ssize_t ret;
 
     printk(KERN_INFO "fixed_dev: read\n");
 
     // Handle non-blocking mode
-    if (!blocking_mode) {
+    if (file_nonblocking(file)) {
         if (mutex_lock_interruptible(&lock))
             return -EINTR;
 
         if (data_size == 0) {
             mutex_unlock(&lock);
+            ctx->eagain++;
+            atomic64_inc(&stat_eagain);
             return -EAGAIN;
         }
     } else {
         // Blocking mode: wait for data
+        if (data_size == 0)
+            atomic64_inc(&stat_blocking_waits);
+
         if (wait_event_interruptible(read_queue, data_size > 0))
             return -EINTR;
 
@@ -116,6 +159,7 @@ static ssize_t my_write(struct file *file, const char __user *user_buf,
 // ==== IOCTL ====
 static long my_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+    struct fixed_stats stats;
     int val;
 
     switch (cmd) {
@@ -135,12 +179,21 @@ static long my_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         if (val != 0 && val != 1)
             return -EINVAL;
 
-        if (mutex_lock_interruptible(&lock))
-            return -EINTR;
+        // Same as fcntl(F_SETFL): only this open file changes mode
+        spin_lock(&file->f_lock);
+        if (val)
+            file->f_flags &= ~O_NONBLOCK;
+        else
+            file->f_flags |= O_NONBLOCK;
+        spin_unlock(&file->f_lock);
+        break;
 
-        blocking_mode = val;
+    case IOCTL_GET_STATS:
+        stats.eagain = atomic64_read(&stat_eagain);
+        stats.blocking_waits = atomic64_read(&stat_blocking_waits);
 
-        mutex_unlock(&lock);
+        if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+            return -EFAULT;
         break;
 
     default:
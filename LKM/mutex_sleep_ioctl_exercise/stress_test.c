@@ -10,6 +10,7 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <time.h>
+#include <stdint.h>
 
 #define DEVICE "/dev/buggy_dev"   // change to buggy_dev, fixed_dev or gold_dev
 
@@ -22,6 +23,12 @@
 #define MY_IOCTL_MAGIC 'k'
 #define IOCTL_RESET _IO(MY_IOCTL_MAGIC, 0)
 #define IOCTL_SET_BLOCKING _IOW(MY_IOCTL_MAGIC, 1, int)
+#define IOCTL_GET_STATS _IOR(MY_IOCTL_MAGIC, 2, struct fixed_stats) // fixed_dev only
+
+struct fixed_stats {
+    uint64_t eagain;
+    uint64_t blocking_waits;
+};
 
 // ==== UTILS ====
 static void rand_sleep()
@@ -122,6 +129,25 @@ void *ioctl_thread(void *arg)
     return NULL;
 }
 
+// ==== STATS ====
+static void print_stats(void)
+{
+    struct fixed_stats stats;
+    int fd = open(DEVICE, O_RDWR | O_NONBLOCK);
+
+    if (fd < 0)
+        return;
+
+    // Drivers without the command answer ENOTTY, nothing to print then
+    if (ioctl(fd, IOCTL_GET_STATS, &stats) == 0) {
+        printf("EAGAIN returned: %llu, blocking waits: %llu\n",
+               (unsigned long long)stats.eagain,
+               (unsigned long long)stats.blocking_waits);
+    }
+
+    close(fd);
+}
+
 // ==== MAIN ====
 int main()
 {
@@ -159,6 +185,8 @@ int main()
 
     pthread_join(ctrl, NULL);
 
+    print_stats();
+
     printf("Stress test complete.\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,466 @@
+#define pr_fmt(fmt) "timer_bench: " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/kernel_stat.h>
+#include <linux/debugfs.h>
+#include <linux/seq_buf.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/delay.h>
+#include <linux/sched/signal.h>
+
+/* ---------- Parameters ---------- */
+
+static int timers = 1000;
+module_param(timers, int, 0644);
+MODULE_PARM_DESC(timers, "Timers armed at once per mechanism and period");
+
+static unsigned int periods_us[8] = { 10, 100, 1000, 10000, 100000, 1000000 };
+static int nr_periods = 6;
+module_param_array(periods_us, uint, &nr_periods, 0644);
+MODULE_PARM_DESC(periods_us, "Timer periods to measure, in microseconds (up to 8)");
+
+static int run_ms = 3000;
+module_param(run_ms, int, 0644);
+MODULE_PARM_DESC(run_ms, "Duration of the measurement of one mechanism at one period (ms)");
+
+/*
+ * 1000 hrtimers firing every 10 us would be 100M interrupts per second:
+ * fewer timers are armed at short periods to stay below max_rate.
+ */
+static int max_rate = 200000;
+module_param(max_rate, int, 0644);
+MODULE_PARM_DESC(max_rate, "Maximum expiries per second of a measurement, all timers together");
+
+static int max_samples = 1 << 18;
+module_param(max_samples, int, 0644);
+MODULE_PARM_DESC(max_samples, "Expiries recorded per measurement, later ones are only counted");
+
+/* ---------- Timers ---------- */
+
+enum tb_mech {
+    MECH_TIMER_LIST,
+    MECH_HRTIMER,
+    MECH_DELAYED_WORK,
+    NR_MECHS,
+};
+
+static const char * const mech_names[] = {
+    [MECH_TIMER_LIST] = "timer_list",
+    [MECH_HRTIMER] = "hrtimer",
+    [MECH_DELAYED_WORK] = "delayed_work",
+};
+
+/* One measurement: a mechanism at a period, and what its timers recorded */
+struct tb_run {
+    int mech;
+    unsigned int period_us;
+    u64 period_ns;
+    bool stopping;
+    atomic_t nr;    /* expiries so far */
+    int max_samples;    /* entries of late and cost */
+    s64 *late;      /* how late each expiry was, negative if early */
+    u64 *cost;      /* time spent in the callback, re-arming included */
+};
+
+struct tb_timer {
+    union {
+        struct timer_list tl;
+        struct hrtimer hr;
+        struct delayed_work dw;
+    };
+    struct tb_run *run;
+    u64 expected_ns;
+};
+
+/* Callbacks run concurrently on any CPU, each takes its own sample slot */
+static void tb_record(struct tb_run *r, s64 late, u64 cost)
+{
+    int i = atomic_inc_return(&r->nr) - 1;
+
+    if (i < r->max_samples) {
+        r->late[i] = late;
+        r->cost[i] = cost;
+    }
+}
+
+/*
+ * Every callback re-arms its timer one period after it ran, until the
+ * run stops. The lateness is measured against the time requested.
+ */
+static void tb_timer_fn(struct timer_list *tl)
+{
+    struct tb_timer *t = from_timer(t, tl, tl);
+    u64 now = ktime_get_ns();
+    s64 late = now - t->expected_ns;
+
+    if (!READ_ONCE(t->run->stopping)) {
+        t->expected_ns = now + t->run->period_ns;
+        mod_timer(tl, jiffies + usecs_to_jiffies(t->run->period_us));
+    }
+
+    tb_record(t->run, late, ktime_get_ns() - now);
+}
+
+static enum hrtimer_restart tb_hrtimer_fn(struct hrtimer *hr)
+{
+    struct tb_timer *t = container_of(hr, struct tb_timer, hr);
+    u64 now = ktime_get_ns();
+    s64 late = now - t->expected_ns;
+    bool stop = READ_ONCE(t->run->stopping);
+
+    if (!stop) {
+        t->expected_ns = now + t->run->period_ns;
+        hrtimer_set_expires(hr, ns_to_ktime(t->expected_ns));
+    }
+
+    tb_record(t->run, late, ktime_get_ns() - now);
+
+    return stop ? HRTIMER_NORESTART : HRTIMER_RESTART;
+}
+
+static void tb_work_fn(struct work_struct *work)
+{
+    struct tb_timer *t = container_of(to_delayed_work(work), struct tb_timer, dw);
+    u64 now = ktime_get_ns();
+    s64 late = now - t->expected_ns;
+
+    if (!READ_ONCE(t->run->stopping)) {
+        t->expected_ns = now + t->run->period_ns;
+        queue_delayed_work(system_wq, &t->dw, usecs_to_jiffies(t->run->period_us));
+    }
+
+    tb_record(t->run, late, ktime_get_ns() - now);
+}
+
+/* Timers start spread over one period, not all at once */
+static void tb_start(struct tb_timer *t, u64 delay_ns)
+{
+    unsigned long delay_j = usecs_to_jiffies(div_u64(delay_ns, NSEC_PER_USEC));
+
+    t->expected_ns = ktime_get_ns() + delay_ns;
+
+    switch (t->run->mech) {
+    case MECH_TIMER_LIST:
+        timer_setup(&t->tl, tb_timer_fn, 0);
+        mod_timer(&t->tl, jiffies + delay_j);
+        break;
+    case MECH_HRTIMER:
+        hrtimer_init(&t->hr, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+        t->hr.function = tb_hrtimer_fn;
+        hrtimer_start(&t->hr, ns_to_ktime(t->expected_ns), HRTIMER_MODE_ABS_HARD);
+        break;
+    case MECH_DELAYED_WORK:
+        INIT_DELAYED_WORK(&t->dw, tb_work_fn);
+        queue_delayed_work(system_wq, &t->dw, delay_j);
+        break;
+    }
+}
+
+/* The callbacks stop re-arming first, so the sync cancels always win */
+static void tb_stop(struct tb_timer *t)
+{
+    switch (t->run->mech) {
+    case MECH_TIMER_LIST:
+        del_timer_sync(&t->tl);
+        break;
+    case MECH_HRTIMER:
+        hrtimer_cancel(&t->hr);
+        break;
+    case MECH_DELAYED_WORK:
+        cancel_delayed_work_sync(&t->dw);
+        break;
+    }
+}
+
+/* ---------- CPU load ---------- */
+
+static int hog_fn(void *data)
+{
+    while (!kthread_should_stop())
+        cond_resched();
+
+    return 0;
+}
+
+/* One spinning thread per online CPU, NULL-terminated */
+static struct task_struct **hogs_start(void)
+{
+    struct task_struct **hogs, *task;
+    int cpu, n = 0;
+
+    hogs = kcalloc(num_online_cpus() + 1, sizeof(*hogs), GFP_KERNEL);
+    if (!hogs)
+        return NULL;
+
+    for_each_online_cpu(cpu) {
+        if (n == num_online_cpus())
+            break;
+
+        task = kthread_create(hog_fn, NULL, "timer_bench_hog/%d", cpu);
+        if (IS_ERR(task))
+            continue;
+
+        kthread_bind(task, cpu);
+        wake_up_process(task);
+        hogs[n++] = task;
+    }
+
+    return hogs;
+}
+
+static void hogs_stop(struct task_struct **hogs)
+{
+    int i;
+
+    for (i = 0; hogs && hogs[i]; i++)
+        kthread_stop(hogs[i]);
+    kfree(hogs);
+}
+
+/* ---------- Measurement ---------- */
+
+/*
+ * Kernel, interrupt and softirq time of all CPUs. Interrupt time is only
+ * accounted separately with CONFIG_IRQ_TIME_ACCOUNTING.
+ */
+static u64 busy_ns(void)
+{
+    struct kernel_cpustat kcs;
+    u64 sum = 0;
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        kcpustat_cpu_fetch(&kcs, cpu);
+        sum += kcs.cpustat[CPUTIME_SYSTEM] + kcs.cpustat[CPUTIME_IRQ] +
+               kcs.cpustat[CPUTIME_SOFTIRQ];
+    }
+
+    return sum;
+}
+
+static int cmp_s64(const void *a, const void *b)
+{
+    s64 x = *(const s64 *)a, y = *(const s64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* permille of n sorted samples */
+#define PCT(v, n, permille) ((v)[div_u64((u64)((n) - 1) * (permille), 1000)])
+
+static int tb_measure(struct seq_buf *s, int mech, unsigned int period_us, bool loaded)
+{
+    struct tb_run run = { .mech = mech, .period_us = period_us };
+    struct tb_timer *t;
+    u64 busy;
+    int i, n, nr;
+    int ret = 0;
+
+    run.period_ns = (u64)period_us * NSEC_PER_USEC;
+    n = clamp_t(u64, div_u64((u64)max_rate * run.period_ns, NSEC_PER_SEC), 1, max(timers, 1));
+
+    /* max_samples can change under a run, the callbacks only use this copy */
+    run.max_samples = max(READ_ONCE(max_samples), 1);
+    run.late = kvmalloc_array(run.max_samples, sizeof(*run.late), GFP_KERNEL);
+    run.cost = kvmalloc_array(run.max_samples, sizeof(*run.cost), GFP_KERNEL);
+    t = kvcalloc(n, sizeof(*t), GFP_KERNEL);
+    if (!run.late || !run.cost || !t) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    busy = busy_ns();
+
+    for (i = 0; i < n; i++) {
+        t[i].run = &run;
+        tb_start(&t[i], run.period_ns + div_u64(run.period_ns * i, n));
+    }
+
+    msleep_interruptible(run_ms);
+
+    WRITE_ONCE(run.stopping, true);
+    for (i = 0; i < n; i++)
+        tb_stop(&t[i]);
+
+    busy = busy_ns() - busy;
+
+    nr = atomic_read(&run.nr);
+    seq_buf_printf(s, "%-13s %9u %6d %9d |", mech_names[mech], period_us, n, nr);
+
+    n = min(nr, run.max_samples);
+    if (!n) {
+        seq_buf_printf(s, " no expiry\n");
+        goto out;
+    }
+
+    sort(run.late, n, sizeof(*run.late), cmp_s64, NULL);
+    sort(run.cost, n, sizeof(*run.cost), cmp_u64, NULL);
+
+    seq_buf_printf(s, " %10lld %10lld %10lld %10lld %10lld | %7llu %7llu |",
+                   run.late[0], PCT(run.late, n, 500), PCT(run.late, n, 990),
+                   PCT(run.late, n, 999), run.late[n - 1],
+                   PCT(run.cost, n, 500), PCT(run.cost, n, 990));
+
+    /* The load threads make the CPU time meaningless */
+    if (loaded)
+        seq_buf_printf(s, " %9s\n", "-");
+    else
+        seq_buf_printf(s, " %9llu\n", div_u64(busy, nr));
+
+out:
+    kvfree(t);
+    kvfree(run.cost);
+    kvfree(run.late);
+    return ret;
+}
+
+static int tb_run_all(struct seq_buf *s, bool loaded)
+{
+    struct task_struct **hogs = NULL;
+    int mech, p, ret = 0;
+
+    if (loaded) {
+        hogs = hogs_start();
+        if (!hogs)
+            return -ENOMEM;
+    }
+
+    seq_buf_printf(s, "=== %s, %d ms per measurement ===\n",
+                   loaded ? "one busy thread per CPU" : "idle", run_ms);
+    seq_buf_printf(s, "%-13s %9s %6s %9s | %-54s | %-15s | %9s\n", "mechanism",
+                   "period_us", "timers", "expiries",
+                   "lateness ns: min median p99 p99.9 max",
+                   "callback ns", "busy ns");
+
+    for (p = 0; p < nr_periods && !ret; p++) {
+        for (mech = 0; mech < NR_MECHS && !ret; mech++) {
+            if (!periods_us[p])
+                continue;
+
+            ret = tb_measure(s, mech, periods_us[p], loaded);
+            if (!ret && fatal_signal_pending(current))
+                ret = -EINTR;
+        }
+    }
+
+    hogs_stop(hogs);
+    return ret;
+}
+
+/* ---------- debugfs reporting ---------- */
+
+#define REPORT_SIZE (64 * 1024)
+#define BENCH_ARG_LEN 16
+
+static struct dentry *debugfs_dir;
+static char *report;
+static size_t report_len;
+/* One run at a time, two would disturb each other */
+static DEFINE_MUTEX(bench_lock);
+
+static ssize_t bench_read(struct file *file, char __user *buf,
+                          size_t count, loff_t *ppos)
+{
+    ssize_t ret;
+
+    if (mutex_lock_interruptible(&bench_lock))
+        return -EINTR;
+
+    ret = simple_read_from_buffer(buf, count, ppos, report, report_len);
+
+    mutex_unlock(&bench_lock);
+    return ret;
+}
+
+/* Writing "idle", "load" or "both" (anything else) runs the benchmark */
+static ssize_t bench_write(struct file *file, const char __user *buf,
+                           size_t count, loff_t *ppos)
+{
+    char arg[BENCH_ARG_LEN], *mode;
+    size_t len = min(count, sizeof(arg) - 1);
+    struct seq_buf s;
+    char *new;
+    int ret = 0;
+
+    if (run_ms < 1 || max_samples < 1 || max_rate < 1 || nr_periods < 1)
+        return -EINVAL;
+
+    if (copy_from_user(arg, buf, len))
+        return -EFAULT;
+    arg[len] = '\0';
+    mode = strim(arg);
+
+    new = kvmalloc(REPORT_SIZE, GFP_KERNEL);
+    if (!new)
+        return -ENOMEM;
+    seq_buf_init(&s, new, REPORT_SIZE);
+
+    if (mutex_lock_interruptible(&bench_lock)) {
+        kvfree(new);
+        return -EINTR;
+    }
+
+    if (strcmp(mode, "load"))
+        ret = tb_run_all(&s, false);
+    if (!ret && strcmp(mode, "idle"))
+        ret = tb_run_all(&s, true);
+    if (seq_buf_has_overflowed(&s))
+        pr_warn("report truncated\n");
+
+    kvfree(report);
+    report = new;
+    report_len = seq_buf_used(&s);
+
+    mutex_unlock(&bench_lock);
+
+    return ret ? ret : count;
+}
+
+static const struct file_operations bench_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = bench_read,
+    .write = bench_write,
+    .llseek = default_llseek,
+};
+
+/* ---------- Init / Exit ---------- */
+
+static int __init timer_bench_init(void)
+{
+    debugfs_dir = debugfs_create_dir("timer_bench", NULL);
+    debugfs_create_file("results", 0600, debugfs_dir, NULL, &bench_fops);
+
+    pr_info("write to /sys/kernel/debug/timer_bench/results to run\n");
+    return 0;
+}
+
+static void __exit timer_bench_exit(void)
+{
+    debugfs_remove_recursive(debugfs_dir);
+    kvfree(report);
+}
+
+module_init(timer_bench_init);
+module_exit(timer_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("timer_list vs hrtimer vs delayed_work precision and cost");